@@ -1,16 +1,12 @@
 #pragma once
 
 #include "Tensor.hpp"
+#include "VectorMath.hpp"
 #include <cmath>
 #include <algorithm>
 #include <numeric>
 
 class ActivationFunctions {
-private: 
-    static float sig(float a) {
-        return 1.0f / (1.0f + exp(-a));
-    }
-
 public:
     enum TYPES {
         RELU,
@@ -27,64 +23,58 @@ public:
         }
     }
 
-    // Derivative of ReLU
-    static void relu_derivative(Tensor& location, const Tensor& a) {
-        for (int i = 0; i < a.data.size(); i++) {
-            location.data[i] = a.data[i] > 0.0f ? 1.0f : 0.0f;
+    // Gradient of ReLU from its saved output: gradOutput where the output is positive
+    static void relu_backward(Tensor& location, const Tensor& output, const Tensor& gradOutput) {
+        const size_t n = output.data.size();
+        const float* y = output.data.data();
+        const float* dy = gradOutput.data.data();
+        float* dx = location.data.data();
+
+#pragma omp parallel for if(n >= Tensor::PARALLEL_THRESHOLD && !Parallel::inParallel())
+        for (size_t i = 0; i < n; i++) {
+            dx[i] = y[i] > 0.0f ? dy[i] : 0.0f;
         }
     }
 
     // Sigmoid activation
     static void sigmoid(Tensor& location, const Tensor& a) {
-        for (int i = 0; i < a.data.size(); i++) {
-            location.data[i] = sig(a.data[i]);
-        }
+        VectorMath::sigmoid(a.data.data(), location.data.data(), a.data.size());
     }
 
-    // Derivative of Sigmoid:
-    static void sigmoid_derivative(Tensor& location, const Tensor& a) {
-        for (int i = 0; i < a.data.size(); i++) {
-            location.data[i] = sig(a.data[i]) * (1 - sig(a.data[i]));
+    // Gradient of Sigmoid from its saved output y: gradOutput * y * (1 - y)
+    static void sigmoid_backward(Tensor& location, const Tensor& output, const Tensor& gradOutput) {
+        const size_t n = output.data.size();
+        const float* y = output.data.data();
+        const float* dy = gradOutput.data.data();
+        float* dx = location.data.data();
+
+#pragma omp parallel for if(n >= Tensor::PARALLEL_THRESHOLD && !Parallel::inParallel())
+        for (size_t i = 0; i < n; i++) {
+            dx[i] = dy[i] * y[i] * (1.0f - y[i]);
         }
     }
 
-    // Softmax activation
+    // Softmax activation, over the second dimension of a batch x logits tensor
     static void softmax(Tensor& location, const Tensor& a) {
         std::vector<size_t> shape = a.getShape();
-        size_t batch_size = shape[0];
-        size_t num_logits = shape[1];
-
-        for (size_t batch_idx = 0; batch_idx < batch_size; ++batch_idx) {
-            float max_val = *std::max_element(a.data.begin() + batch_idx * num_logits,
-                a.data.begin() + (batch_idx + 1) * num_logits);
-            max_val = std::min(std::max(max_val, -50.0f), 50.0f); 
-
-            float sum = 0.0f;
-
-            for (size_t i = 0; i < num_logits; i++) {
-                size_t idx = batch_idx * num_logits + i;
-                float val = std::exp(a.data[idx] - max_val);
-                val = std::min(std::max(val, 1e-20f), 1e20f); 
-                location.data[idx] = val;
-                sum += val;
-            }
-
-            sum = std::max(sum, 1e-20f);
-            for (size_t i = 0; i < num_logits; i++) {
-                size_t idx = batch_idx * num_logits + i;
-                location.data[idx] /= sum;
-            }
-        }
+        VectorMath::softmax(a.data.data(), location.data.data(), shape[0], a.data.size() / shape[0]);
     }
 
-    
-    // Derivative of softmax (diagonals of jacobian): 
-    static void softmax_derivative(Tensor& location, const Tensor& a) {
-        Tensor _sm = Tensor(a.getShape());
-        softmax(_sm, a);
-
-        for (size_t i = 0; i < a.data.size(); i++) {
-            location.data[i] = _sm.data[i] * (1 - _sm.data[i]);
+    // Gradient of softmax from its saved output y, the full jacobian product of every row:
+    // y_i * (gradOutput_i - sum_j gradOutput_j * y_j)
+    static void softmax_backward(Tensor& location, const Tensor& output, const Tensor& gradOutput) {
+        const size_t rows = output.getShape()[0];
+        const size_t cols = output.data.size() / rows;
+
+#pragma omp parallel for if(output.data.size() >= VectorMath::BLOCK && rows > 1 && !Parallel::inParallel())
+        for (size_t r = 0; r < rows; r++) {
+            const float* y = output.data.data() + r * cols;
+            const float* dy = gradOutput.data.data() + r * cols;
+            float* dx = location.data.data() + r * cols;
+
+            float dot = 0.0f;
+            for (size_t i = 0; i < cols; i++) dot += dy[i] * y[i];
+            for (size_t i = 0; i < cols; i++) dx[i] = y[i] * (dy[i] - dot);
         }
     }
 
@@ -3,15 +3,55 @@
 #include "Layer.hpp"
 
 class ActivationLayer : public Layer {
+private:
+	// the previous layer already applies this activation in its epilogue
+	bool passthrough = false;
+
 public:
 	ActivationLayer(ActivationFunctions::TYPES _activation_function) : Layer(_activation_function) {}
 
+	const char* getType() const override {
+		return "Activation";
+	}
+
+	// element-wise activations run on any layout, softmax needs whole NCHW rows
+	bool supportsLayout(Layout::TYPES _layout) const override {
+		return _layout == Layout::NCHW ||
+			activation_function == ActivationFunctions::TYPES::RELU ||
+			activation_function == ActivationFunctions::TYPES::SIGMOID;
+	}
+
+	void fuseActivation(const Layer* previous) override {
+		passthrough = previous && previous->fusesActivation() &&
+			previous->getActivationFunction() == activation_function;
+	}
+
 	void initialize(std::vector<size_t> is) override {
 		input_shape = is;
 		output_shape = is;
 	}
 
+	// a passthrough layer is a view of the previous layer's output and gets no buffers
+	bool isView() const override {
+		return passthrough;
+	}
+
+	Cost forwardCost() const override {
+		if (passthrough) return { 0.0, 0.0 };
+		return { elements(output_shape), 2 * elements(output_shape) * sizeof(float) };
+	}
+
+	Cost backwardCost() const override {
+		if (passthrough) return { 0.0, 0.0 };
+		return { elements(output_shape), 3 * elements(output_shape) * sizeof(float) };
+	}
+
 	void forward() override {
+		if (passthrough) {
+			output->bind(input->data.data());
+			return;
+		}
+
 		switch (activation_function) {
 		case (ActivationFunctions::TYPES::RELU):
 			ActivationFunctions::relu(*output, *input);
@@ -29,18 +69,21 @@ public:
 	}
 
 	void backward(const Tensor& gradOutput) override {
+		if (passthrough) {
+			input_gradient->bind(const_cast<float*>(gradOutput.data.data()));
+			return;
+		}
+
 		switch (activation_function) {
+		// the output of forward is still in place, the gradients are taken from it
 		case (ActivationFunctions::TYPES::RELU):
-			ActivationFunctions::relu_derivative(*input_gradient, *input);
-			*input_gradient = gradOutput * *input_gradient; 
+			ActivationFunctions::relu_backward(*input_gradient, *output, gradOutput);
 			break;
 		case (ActivationFunctions::TYPES::SIGMOID):
-			ActivationFunctions::sigmoid_derivative(*input_gradient, *input);
-			*input_gradient = gradOutput * *input_gradient;
+			ActivationFunctions::sigmoid_backward(*input_gradient, *output, gradOutput);
 			break;
 		case (ActivationFunctions::TYPES::SOFTMAX):
-			ActivationFunctions::softmax_derivative(*input_gradient, *input);
-			*input_gradient = gradOutput * *input_gradient;
+			ActivationFunctions::softmax_backward(*input_gradient, *output, gradOutput);
 			break;
 		case (ActivationFunctions::TYPES::SOFTMAX_CEL):
 			*input_gradient = gradOutput;
@@ -1,3 +1,5 @@
+#pragma once
+
 #include "Optimizer.hpp"
 #include <unordered_map>
 #include <iostream>
@@ -11,11 +13,45 @@ private:
 
 	std::unordered_map<Tensor*, std::pair<Tensor, Tensor>> moments;	
 
+	// moments for step(), laid out like the parameter arena
+	std::vector<float> m;
+	std::vector<float> v;
+	float bias_correction1 = 1.0f;
+	float bias_correction2 = 1.0f;
+
 public:
 	Adam(float lr = 0.001, float beta1 = 0.9, float beta2 = 0.999, float epsilon = 1e-4)
 		: Optimizer(lr), beta1(beta1), beta2(beta2),
 		  epsilon(epsilon), t(0) {};
 
+	// t advances once per step, the moments are laid out like the parameter arena
+	void beginStep(size_t n) override {
+		if (m.size() != n) {
+			m.assign(n, 0.0f);
+			v.assign(n, 0.0f);
+			t = 0;
+		}
+
+		t++;
+		bias_correction1 = 1.0f / (1 - std::pow(beta1, t));
+		bias_correction2 = 1.0f / (1 - std::pow(beta2, t));
+	}
+
+	// One fused pass over a range of the parameters
+	void stepRange(float* parameters, const float* gradients, size_t begin, size_t end) override {
+#pragma omp parallel for if(end - begin >= Tensor::PARALLEL_THRESHOLD)
+		for (size_t i = begin; i < end; i++) {
+			const float g = gradients[i];
+			m[i] = beta1 * m[i] + (1 - beta1) * g;
+			v[i] = beta2 * v[i] + (1 - beta2) * g * g;
+
+			const float m_hat = m[i] * bias_correction1;
+			const float v_hat = v[i] * bias_correction2;
+			parameters[i] -= learning_rate * m_hat / (std::sqrt(v_hat) + epsilon);
+		}
+	}
+
+	// Per tensor update, kept for callers outside Network. Note t advances on every call here.
 	void updateWeights(Tensor& weights, const Tensor& gradients) override {		
 		if (!moments.count(&weights)) {
 			initialize_moments(weights);
@@ -23,22 +59,25 @@ public:
 		}
 
 		auto& a = moments[&weights];
-		auto& m = a.first;
-		auto& v = a.second;
+		auto& tm = a.first;
+		auto& tv = a.second;
 
 		t++;
 
-		m = m * beta1 + gradients * (1 - beta1);
-		v = v * beta2 + gradients.square() * (1 - beta2);
-
-		float bias_correction1 = 1 - std::pow(beta1, t);
-		float bias_correction2 = 1 - std::pow(beta2, t);
+		const float bias_correction1 = 1.0f / (1 - std::pow(beta1, t));
+		const float bias_correction2 = 1.0f / (1 - std::pow(beta2, t));
 
-		Tensor m_hat = m * (1.0f / bias_correction1);
-		Tensor v_hat = v * (1.0f / bias_correction2);
+		// m, v and the weights are updated in a single pass, no temporaries
+#pragma omp parallel for if(weights.data.size() >= Tensor::PARALLEL_THRESHOLD)
+		for (size_t i = 0; i < weights.data.size(); i++) {
+			const float g = gradients.data[i];
+			tm.data[i] = beta1 * tm.data[i] + (1 - beta1) * g;
+			tv.data[i] = beta2 * tv.data[i] + (1 - beta2) * g * g;
 
-		// Apply update
-		weights -= (m_hat * learning_rate) / (v_hat.sqrt() + epsilon);
+			const float m_hat = tm.data[i] * bias_correction1;
+			const float v_hat = tv.data[i] * bias_correction2;
+			weights.data[i] -= learning_rate * m_hat / (std::sqrt(v_hat) + epsilon);
+		}
 	};
 
 private: 
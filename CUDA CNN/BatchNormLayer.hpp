@@ -1,3 +1,5 @@
+#pragma once
+
 #include "Layer.hpp"
 
 class BatchNormLayer : public Layer {
@@ -5,6 +7,10 @@ private:
 
 public:
 	BatchNormLayer() : Layer() {}
+
+	const char* getType() const override {
+		return "BatchNorm";
+	}
 	
 	void initialize(std::vector<size_t> input_shape) {};
 	void forward() {
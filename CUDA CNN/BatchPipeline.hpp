@@ -0,0 +1,148 @@
+#pragma once
+
+#include "Tensor.hpp"
+#include <vector>
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+#include <random>
+#include <numeric>
+#include <algorithm>
+#include <cstring>
+
+// Producer/consumer source of training batches. A background worker gathers rows of data and
+// labels through a shuffled permutation into a ring of batch slots while the caller trains on an
+// earlier slot, so copying and shuffling stay off the training thread. Without shuffling a batch is
+// a run of consecutive rows, and the slots are views of data and labels instead of copies.
+//
+// The stream is endless: after batchesPerEpoch() batches the worker reshuffles and carries on with
+// the next epoch. Samples past the last full batch are skipped for that epoch. data and labels
+// must outlive the pipeline.
+class BatchPipeline {
+public:
+	struct Batch {
+		Tensor input;
+		Tensor labels;
+	};
+
+	BatchPipeline(const Tensor& _data, const Tensor& _labels, size_t _batch_size, bool _shuffle = true,
+				  size_t depth = 3, unsigned seed = std::random_device{}())
+		: data(_data), labels(_labels), batch_size(_batch_size), shuffle(_shuffle),
+		  slots(std::max<size_t>(depth, 2)), rng(seed)
+	{
+		samples = data.getShape()[0];
+		if (labels.getShape()[0] != samples) {
+			throw std::invalid_argument("Data and labels must have the same number of samples.");
+		}
+		if (!batch_size || batch_size > samples) {
+			throw std::invalid_argument("Batch size must be between 1 and the number of samples.");
+		}
+
+		std::vector<size_t> input_shape = data.getShape(), label_shape = labels.getShape();
+		input_shape[0] = label_shape[0] = batch_size;
+
+		// unshuffled slots are bound to rows of data and labels as they are produced
+		if (shuffle) {
+			for (Batch& slot : slots) {
+				slot.input = Tensor::uninitialized(input_shape);
+				slot.labels = Tensor::uninitialized(label_shape);
+			}
+		}
+
+		order.resize(samples);
+		std::iota(order.begin(), order.end(), size_t(0));
+
+		worker = std::thread(&BatchPipeline::run, this);
+	}
+
+	~BatchPipeline() {
+		{
+			std::lock_guard<std::mutex> lock(mutex);
+			stopping = true;
+		}
+		changed.notify_all();
+		worker.join();
+	}
+
+	BatchPipeline(const BatchPipeline&) = delete;
+	BatchPipeline& operator=(const BatchPipeline&) = delete;
+
+	size_t batchesPerEpoch() const { return samples / batch_size; }
+	size_t batchSize() const { return batch_size; }
+
+	// Blocks until the next batch has been gathered, it stays valid until release()
+	Batch& acquire() {
+		std::unique_lock<std::mutex> lock(mutex);
+		changed.wait(lock, [this] { return produced > consumed; });
+		return slots[consumed % slots.size()];
+	}
+
+	// Hands the slot returned by acquire() back to the worker
+	void release() {
+		{
+			std::lock_guard<std::mutex> lock(mutex);
+			consumed++;
+		}
+		changed.notify_all();
+	}
+
+private:
+	const Tensor& data;
+	const Tensor& labels;
+	size_t samples = 0;
+	size_t batch_size;
+	bool shuffle;
+
+	std::vector<Batch> slots;
+	std::vector<size_t> order;
+	std::mt19937 rng;
+
+	// batches handed out so far and batches given back, slot i holds batch i % slots.size()
+	size_t produced = 0;
+	size_t consumed = 0;
+	bool stopping = false;
+
+	std::mutex mutex;
+	std::condition_variable changed;
+	std::thread worker;
+
+	void run() {
+		for (size_t batch = 0; ; batch = (batch + 1) % batchesPerEpoch()) {
+			if (batch == 0 && shuffle) {
+				std::shuffle(order.begin(), order.end(), rng);
+			}
+
+			size_t slot;
+			{
+				std::unique_lock<std::mutex> lock(mutex);
+				changed.wait(lock, [this] { return stopping || produced - consumed < slots.size(); });
+				if (stopping) return;
+				slot = produced % slots.size();
+			}
+
+			if (shuffle) {
+				const size_t* rows = order.data() + batch * batch_size;
+				gather(data, slots[slot].input, rows);
+				gather(labels, slots[slot].labels, rows);
+			}
+			else {
+				slots[slot].input = data.rows(batch * batch_size, batch_size);
+				slots[slot].labels = labels.rows(batch * batch_size, batch_size);
+			}
+
+			{
+				std::lock_guard<std::mutex> lock(mutex);
+				produced++;
+			}
+			changed.notify_all();
+		}
+	}
+
+	void gather(const Tensor& source, Tensor& batch, const size_t* rows) const {
+		const size_t row_size = source.data.size() / samples;
+
+		for (size_t r = 0; r < batch_size; r++) {
+			std::memcpy(batch.data.data() + r * row_size, source.data.data() + rows[r] * row_size, row_size * sizeof(float));
+		}
+	}
+};
@@ -0,0 +1,388 @@
+// Layer microbenchmarks: sweeps the kernels of every layer, the loss and the optimizers over a
+// matrix of batch sizes, channels, spatial sizes and thread counts, reports latency percentiles
+// and throughput, writes the results as JSON and flags regressions against a saved baseline.
+//
+//     benchmark [--quick] [--filter TEXT] [--threads 1,4] [--iterations N]
+//               [--json results.json] [--baseline baseline.json] [--tolerance 0.10]
+//
+// The exit code is 1 when a case is slower than its baseline by more than the tolerance.
+
+#include "ConvLayer.hpp"
+#include "DenseLayer.hpp"
+#include "PoolLayer.hpp"
+#include "ActivationLayer.hpp"
+#include "CrossEntropyLoss.hpp"
+#include "SGD.hpp"
+#include "Adam.hpp"
+#include "Parallel.hpp"
+#include <chrono>
+#include <fstream>
+#include <functional>
+#include <iomanip>
+#include <iostream>
+#include <map>
+#include <memory>
+#include <random>
+#include <sstream>
+#include <string>
+#include <vector>
+
+namespace {
+
+struct Options {
+	bool quick = false;
+	std::string filter;
+	std::vector<int> threads;
+	size_t iterations = 0;
+	std::string json;
+	std::string baseline;
+	double tolerance = 0.10;
+};
+
+struct Result {
+	std::string name;
+	size_t iterations;
+	double mean_ms;
+	double p50_ms;
+	double p90_ms;
+	double p99_ms;
+	double samples_per_second;
+	double gflops;
+};
+
+// A benchmark case: run performs one call of the kernel under test, samples and flops describe
+// that call for the throughput columns
+struct Case {
+	std::string name;
+	std::function<void()> run;
+	size_t samples;
+	double flops;
+};
+
+void fillRandom(Tensor& tensor, std::mt19937& rng) {
+	std::uniform_real_distribution<float> dist(-1.0f, 1.0f);
+	for (size_t i = 0; i < tensor.data.size(); i++) tensor.data[i] = dist(rng);
+}
+
+// Owns a layer together with its input and output gradient, wired up the way Network does
+struct LayerFixture {
+	std::unique_ptr<Layer> layer;
+	Tensor input;
+	Tensor output_gradient;
+
+	LayerFixture(Layer* _layer, std::vector<size_t> input_shape, Precision::TYPES precision) : layer(_layer) {
+		const size_t batch = input_shape[0];
+		std::mt19937 rng(42);
+
+		input_shape[0] = 1;
+		layer->initialize(input_shape);
+		layer->fuseActivation(nullptr);
+		layer->setPrecision(precision);
+		layer->initOutput(batch);
+		layer->bindBuffers(nullptr, nullptr);
+
+		input_shape[0] = batch;
+		input = Tensor(input_shape);
+		fillRandom(input, rng);
+		layer->setInput(&input);
+
+		output_gradient = Tensor(layer->getOutputShape());
+		fillRandom(output_gradient, rng);
+
+		// backward reads the outputs and saved state of a forward
+		layer->forward();
+	}
+};
+
+std::string shapeName(const std::vector<size_t>& shape) {
+	std::ostringstream name;
+	for (size_t i = 0; i < shape.size(); i++) name << (i ? "x" : "") << shape[i];
+	return name.str();
+}
+
+// Builds its fixture on first use, so cases removed by --filter cost nothing
+struct LazyFixture {
+	std::function<Layer*()> make;
+	std::vector<size_t> input_shape;
+	Precision::TYPES precision;
+	std::unique_ptr<LayerFixture> fixture;
+
+	LayerFixture& get() {
+		if (!fixture) fixture.reset(new LayerFixture(make(), input_shape, precision));
+		return *fixture;
+	}
+};
+
+// forward and backward cases of one layer configuration, with the weights stored in precision
+void addLayerCases(std::vector<Case>& cases, const std::string& name, std::function<Layer*()> make, const std::vector<size_t>& input_shape,
+				   Precision::TYPES precision = Precision::FLOAT32) {
+	std::shared_ptr<LazyFixture> lazy = std::make_shared<LazyFixture>();
+	lazy->make = make;
+	lazy->input_shape = input_shape;
+	lazy->precision = precision;
+
+	// the cost model only needs the shapes
+	std::unique_ptr<Layer> probe(make());
+	std::vector<size_t> probe_shape = input_shape;
+	probe_shape[0] = 1;
+	probe->initialize(probe_shape);
+	probe->initOutput(input_shape[0]);
+
+	const std::string prefix = name + "/" + shapeName(input_shape);
+
+	cases.push_back({ prefix + "/forward", [lazy]() { lazy->get().layer->forward(); },
+					  input_shape[0], probe->forwardCost().flops });
+	cases.push_back({ prefix + "/backward", [lazy]() { LayerFixture& f = lazy->get(); f.layer->backward(f.output_gradient); },
+					  input_shape[0], probe->backwardCost().flops });
+}
+
+std::vector<Case> buildCases(const Options& options) {
+	std::vector<Case> cases;
+	const ActivationFunctions::TYPES RELU = ActivationFunctions::TYPES::RELU;
+
+	const std::vector<size_t> batches = options.quick ? std::vector<size_t>{ 32 } : std::vector<size_t>{ 1, 32, 128 };
+
+	// convolutions: { input channels, filters, spatial size, kernel, stride, padding }
+	struct ConvConfig { size_t channels, filters, size, kernel, stride, padding; };
+	std::vector<ConvConfig> convs = { { 1, 32, 28, 3, 1, 0 }, { 32, 32, 26, 3, 1, 0 }, { 64, 64, 10, 3, 1, 0 } };
+	if (!options.quick) {
+		convs.push_back({ 64, 128, 14, 3, 1, 1 });
+		convs.push_back({ 128, 128, 7, 1, 1, 0 });
+		convs.push_back({ 32, 64, 28, 3, 2, 1 });
+	}
+
+	for (size_t batch : batches) {
+		for (const ConvConfig& c : convs) {
+			std::ostringstream name;
+			name << "Conv/f" << c.filters << "k" << c.kernel << "s" << c.stride << "p" << c.padding;
+			addLayerCases(cases, name.str(), [c, RELU]() { return new ConvLayer(c.filters, c.kernel, c.kernel, c.stride, c.padding, RELU); },
+						  { batch, c.channels, c.size, c.size });
+		}
+
+		// dense: { inputs, outputs }
+		std::vector<std::pair<size_t, size_t>> denses = { { 1600, 512 }, { 512, 10 } };
+		if (!options.quick) denses.push_back({ 1024, 1024 });
+
+		for (const auto& d : denses) {
+			addLayerCases(cases, "Dense/o" + std::to_string(d.second), [d, RELU]() { return new DenseLayer(d.second, RELU); },
+						  { batch, d.first });
+		}
+
+		// bf16 weights through the im2col and dense GEMMs
+		addLayerCases(cases, "Conv/f32k3s1p0-bf16", [RELU]() { return new ConvLayer(32, 3, 3, 1, 0, RELU); },
+					  { batch, 1, 28, 28 }, Precision::BFLOAT16);
+		addLayerCases(cases, "Dense/o512-bf16", [RELU]() { return new DenseLayer(512, RELU); },
+					  { batch, 1600 }, Precision::BFLOAT16);
+
+		// pooling: { channels, spatial size }
+		std::vector<std::pair<size_t, size_t>> pools = { { 32, 24 }, { 64, 10 } };
+		for (const auto& p : pools) {
+			addLayerCases(cases, "Pool/w2s2", []() { return new PoolLayer(2, 2); }, { batch, p.first, p.second, p.second });
+		}
+
+		addLayerCases(cases, "Activation/relu", [RELU]() { return new ActivationLayer(RELU); }, { batch, 32, 24, 24 });
+		addLayerCases(cases, "Activation/sigmoid", []() { return new ActivationLayer(ActivationFunctions::TYPES::SIGMOID); }, { batch, 32, 24, 24 });
+		addLayerCases(cases, "Activation/softmax", []() { return new ActivationLayer(ActivationFunctions::TYPES::SOFTMAX); }, { batch, 1000 });
+
+		// loss over a batch of class probabilities
+		for (size_t classes : { size_t(10), size_t(1000) }) {
+			auto labels = std::make_shared<Tensor>(std::vector<size_t>{ batch, classes });
+			auto predictions = std::make_shared<Tensor>(std::vector<size_t>{ batch, classes }, 1.0f / classes);
+			for (size_t i = 0; i < batch; i++) labels->data[i * classes + i % classes] = 1.0f;
+			auto loss = std::make_shared<CrossEntropyLoss>();
+
+			const std::string prefix = "CrossEntropyLoss/" + shapeName({ batch, classes });
+			cases.push_back({ prefix + "/compute", [=]() { loss->compute(*labels, *predictions); }, batch, 0.0 });
+			cases.push_back({ prefix + "/backward", [=]() { loss->backward(*labels, *predictions); }, batch, 0.0 });
+
+			// the fused softmax, loss and gradient from logits, with one-hot and sparse labels
+			auto sparse = std::make_shared<Tensor>(std::vector<size_t>{ batch });
+			auto gradient = std::make_shared<Tensor>(std::vector<size_t>{ batch, classes });
+			for (size_t i = 0; i < batch; i++) sparse->data[i] = static_cast<float>(i % classes);
+
+			cases.push_back({ prefix + "/fromLogits", [=]() { loss->computeFromLogits(*labels, *predictions, *gradient); }, batch, 0.0 });
+			cases.push_back({ prefix + "/fromLogits-sparse", [=]() { loss->computeFromLogits(*sparse, *predictions, *gradient); }, batch, 0.0 });
+		}
+	}
+
+	// one optimizer step over an arena of n parameters, samples counts parameters here
+	const std::vector<size_t> sizes = options.quick ? std::vector<size_t>{ size_t(1) << 20 } : std::vector<size_t>{ size_t(1) << 16, size_t(1) << 20, size_t(1) << 23 };
+
+	for (size_t n : sizes) {
+		auto parameters = std::make_shared<std::vector<float>>(n, 0.5f);
+		auto gradients = std::make_shared<std::vector<float>>(n, 1e-3f);
+		auto sgd = std::make_shared<SGD>(1e-6f);
+		auto adam = std::make_shared<Adam>(1e-6f);
+
+		cases.push_back({ "SGD/" + std::to_string(n) + "/step", [=]() { sgd->step(parameters->data(), gradients->data(), n); }, n, 2.0 * n });
+		cases.push_back({ "Adam/" + std::to_string(n) + "/step", [=]() { adam->step(parameters->data(), gradients->data(), n); }, n, 12.0 * n });
+	}
+
+	return cases;
+}
+
+double percentile(std::vector<double> sorted, double p) {
+	const size_t index = std::min(sorted.size() - 1, static_cast<size_t>(p * (sorted.size() - 1) + 0.5));
+	return sorted[index];
+}
+
+// Times iterations calls after a warmup; without a fixed count, runs for about 0.2 s (0.05 s quick)
+Result measure(const Case& c, const std::string& name, const Options& options) {
+	typedef std::chrono::steady_clock Clock;
+
+	c.run();
+
+	size_t iterations = options.iterations;
+	if (!iterations) {
+		Clock::time_point start = Clock::now();
+		c.run();
+		const double once = std::chrono::duration<double>(Clock::now() - start).count();
+		const double budget = options.quick ? 0.05 : 0.2;
+		iterations = static_cast<size_t>(std::max(5.0, std::min(1000.0, budget / std::max(once, 1e-7))));
+	}
+
+	std::vector<double> times(iterations);
+	for (size_t i = 0; i < iterations; i++) {
+		Clock::time_point start = Clock::now();
+		c.run();
+		times[i] = std::chrono::duration<double, std::milli>(Clock::now() - start).count();
+	}
+
+	double mean = 0.0;
+	for (double t : times) mean += t;
+	mean /= iterations;
+	std::sort(times.begin(), times.end());
+
+	const double p50 = percentile(times, 0.5);
+	return { name, iterations, mean, p50, percentile(times, 0.9), percentile(times, 0.99),
+			 c.samples / (p50 * 1e-3), c.flops / (p50 * 1e-3) * 1e-9 };
+}
+
+void writeJson(const std::string& path, const std::vector<Result>& results) {
+	std::ofstream out(path);
+	if (!out.is_open()) throw std::runtime_error("Failed to create " + path);
+
+	// one result per line, which readBaseline relies on
+	out << "{\n  \"results\": [\n" << std::setprecision(9);
+	for (size_t i = 0; i < results.size(); i++) {
+		const Result& r = results[i];
+		out << "    { \"name\": \"" << r.name << "\", \"iterations\": " << r.iterations
+			<< ", \"mean_ms\": " << r.mean_ms << ", \"p50_ms\": " << r.p50_ms << ", \"p90_ms\": " << r.p90_ms
+			<< ", \"p99_ms\": " << r.p99_ms << ", \"samples_per_second\": " << r.samples_per_second
+			<< ", \"gflops\": " << r.gflops << " }" << (i + 1 < results.size() ? "," : "") << "\n";
+	}
+	out << "  ]\n}\n";
+}
+
+// median latency of every case in a file written by writeJson
+std::map<std::string, double> readBaseline(const std::string& path) {
+	std::ifstream in(path);
+	if (!in.is_open()) throw std::runtime_error("Failed to open baseline " + path);
+
+	std::map<std::string, double> baseline;
+	std::string line;
+	while (std::getline(in, line)) {
+		const size_t name = line.find("\"name\": \""), p50 = line.find("\"p50_ms\": ");
+		if (name == std::string::npos || p50 == std::string::npos) continue;
+
+		const size_t begin = name + 9, end = line.find('"', begin);
+		baseline[line.substr(begin, end - begin)] = std::stod(line.substr(p50 + 10));
+	}
+	return baseline;
+}
+
+std::vector<int> parseList(const std::string& text) {
+	std::vector<int> values;
+	std::stringstream stream(text);
+	std::string item;
+	while (std::getline(stream, item, ',')) values.push_back(std::stoi(item));
+	return values;
+}
+
+Options parseOptions(int argc, char** argv) {
+	Options options;
+
+	for (int i = 1; i < argc; i++) {
+		const std::string arg = argv[i];
+		auto value = [&]() -> std::string {
+			if (i + 1 >= argc) throw std::invalid_argument("Missing value for " + arg);
+			return argv[++i];
+		};
+
+		if (arg == "--quick") options.quick = true;
+		else if (arg == "--filter") options.filter = value();
+		else if (arg == "--threads") options.threads = parseList(value());
+		else if (arg == "--iterations") options.iterations = std::stoul(value());
+		else if (arg == "--json") options.json = value();
+		else if (arg == "--baseline") options.baseline = value();
+		else if (arg == "--tolerance") options.tolerance = std::stod(value());
+		else throw std::invalid_argument("Unknown option " + arg);
+	}
+
+	// single threaded and every core by default
+	if (options.threads.empty()) {
+		options.threads.push_back(1);
+		if (Parallel::maxThreads() > 1) options.threads.push_back(Parallel::maxThreads());
+	}
+
+	return options;
+}
+
+}
+
+int main(int argc, char** argv) {
+	try {
+		const Options options = parseOptions(argc, argv);
+		const std::vector<Case> cases = buildCases(options);
+
+		std::map<std::string, double> baseline;
+		if (!options.baseline.empty()) baseline = readBaseline(options.baseline);
+
+		std::vector<Result> results;
+		size_t regressions = 0;
+
+		std::cout << std::left << std::setw(52) << "case" << std::right << std::setw(7) << "iters" << std::setw(10) << "p50 ms"
+				  << std::setw(10) << "p90 ms" << std::setw(10) << "p99 ms" << std::setw(12) << "samples/s" << std::setw(9) << "GFLOP/s"
+				  << std::setw(10) << "baseline" << "\n" << std::fixed;
+
+		for (int threads : options.threads) {
+			Parallel::setThreads(threads);
+
+			for (const Case& c : cases) {
+				const std::string name = c.name + "/t" + std::to_string(threads);
+				if (!options.filter.empty() && name.find(options.filter) == std::string::npos) continue;
+
+				Result r = measure(c, name, options);
+				results.push_back(r);
+
+				std::cout << std::left << std::setw(52) << r.name << std::right << std::setw(7) << r.iterations << std::setprecision(3)
+						  << std::setw(10) << r.p50_ms << std::setw(10) << r.p90_ms << std::setw(10) << r.p99_ms
+						  << std::setprecision(0) << std::setw(12) << r.samples_per_second << std::setprecision(1) << std::setw(9) << r.gflops;
+
+				auto base = baseline.find(r.name);
+				if (base != baseline.end()) {
+					const double change = r.p50_ms / base->second - 1.0;
+					std::cout << std::showpos << std::setw(9) << change * 100.0 << "%" << std::noshowpos;
+
+					if (change > options.tolerance) {
+						std::cout << "  REGRESSION";
+						regressions++;
+					}
+				}
+				std::cout << std::endl;
+			}
+		}
+
+		if (!options.json.empty()) writeJson(options.json, results);
+
+		if (!baseline.empty()) {
+			std::cout << regressions << " regression(s) beyond " << options.tolerance * 100.0 << "% of the baseline median" << std::endl;
+		}
+
+		return regressions ? 1 : 0;
+	}
+	catch (const std::exception& e) {
+		std::cerr << e.what() << std::endl;
+		return 2;
+	}
+}
\ No newline at end of file
@@ -0,0 +1,67 @@
+#pragma once
+
+#include "Transport.hpp"
+#include <vector>
+#include <algorithm>
+
+// Collective operations over the ring of a Transport. Every rank must make the same calls in the
+// same order with the same counts.
+class Collectives {
+public:
+	// Ring all-reduce: afterwards every rank holds the elementwise sum of data over all ranks.
+	// The buffer is cut into size() chunks; a reduce-scatter leaves each rank with one fully summed
+	// chunk, an all-gather then passes the summed chunks around. Each rank sends and receives
+	// 2 * (size() - 1) / size() of the buffer, independent of the number of ranks.
+	static void allReduce(Transport& transport, float* data, size_t count, std::vector<float>& scratch) {
+		const size_t n = transport.size(), rank = transport.rank();
+		if (n == 1 || !count) return;
+
+		scratch.resize(count / n + 1);
+
+		for (size_t step = 0; step + 1 < n; step++) {
+			const size_t send = (rank + n - step) % n, recv = (rank + n - step - 1) % n;
+
+			transport.sendRecv(data + chunkBegin(count, n, send), chunkSize(count, n, send) * sizeof(float),
+							   scratch.data(), chunkSize(count, n, recv) * sizeof(float));
+
+			float* sum = data + chunkBegin(count, n, recv);
+			const size_t size = chunkSize(count, n, recv);
+			for (size_t i = 0; i < size; i++) sum[i] += scratch[i];
+		}
+
+		// rank r now owns the summed chunk r + 1
+		for (size_t step = 0; step + 1 < n; step++) {
+			const size_t send = (rank + 1 + n - step) % n, recv = (rank + n - step) % n;
+
+			transport.sendRecv(data + chunkBegin(count, n, send), chunkSize(count, n, send) * sizeof(float),
+							   data + chunkBegin(count, n, recv), chunkSize(count, n, recv) * sizeof(float));
+		}
+	}
+
+	// Copies data of rank 0 to every other rank, passed along the ring in pieces so all the links
+	// carry a piece at the same time
+	static void broadcast(Transport& transport, float* data, size_t count) {
+		const size_t n = transport.size(), rank = transport.rank();
+		if (n == 1) return;
+
+		for (size_t begin = 0; begin < count; begin += BROADCAST_PIECE) {
+			const size_t size = std::min(size_t(BROADCAST_PIECE), count - begin);
+
+			if (rank != 0) transport.recv(data + begin, size * sizeof(float));
+			if (transport.next() != 0) transport.send(data + begin, size * sizeof(float));
+		}
+	}
+
+private:
+	// floats forwarded at a time by broadcast
+	static const size_t BROADCAST_PIECE = 1 << 16;
+
+	// chunk c of n over count floats, the first count % n chunks take one extra float
+	static size_t chunkSize(size_t count, size_t n, size_t c) {
+		return count / n + (c < count % n);
+	}
+
+	static size_t chunkBegin(size_t count, size_t n, size_t c) {
+		return c * (count / n) + std::min(c, count % n);
+	}
+};
\ No newline at end of file
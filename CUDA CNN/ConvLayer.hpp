@@ -1,15 +1,63 @@
 #pragma once
 
 #include "Layer.hpp"
+#include "Gemm.hpp"
+#include "Im2Col.hpp"
+#include "Winograd.hpp"
 
 class ConvLayer : public Layer {
+public:
+	enum ALGORITHMS {
+		AUTO, // picked in initialize from the layer shape
+		DIRECT,
+		IM2COL,
+		WINOGRAD_2X2, // F(2x2, 3x3), 3x3 stride 1 only
+		WINOGRAD_4X4  // F(4x4, 3x3), fewer multiplies but less accurate
+	};
+
 private:
+	// largest per-image column matrix (in floats) that AUTO will lower with im2col
+	static const size_t IM2COL_MAX_COLUMN = 1 << 24;
+	// fewest input channels and filters for which AUTO picks Winograd over im2col
+	static const size_t WINOGRAD_MIN_CHANNELS = 32;
+
 	size_t num_filters;
 	size_t filter_width;
 	size_t filter_height;
 	size_t stride;
 	size_t padding;
 
+	ALGORITHMS algorithm = AUTO;
+	ALGORITHMS selected_algorithm = DIRECT;
+
+	// im2col scratch, one column matrix per thread
+	std::vector<float> columns;
+	std::vector<float> column_gradient;
+	std::vector<float> weight_partials;
+
+	// Winograd transformed filters, for the forward pass and (rotated, filters and channels
+	// swapped) for backward data. They are redone only when the weights differ from
+	// winograd_source, the weights they were computed from.
+	std::vector<float> winograd_filters;
+	std::vector<float> winograd_data_filters;
+	std::vector<float> winograd_source;
+	std::vector<float> winograd_scratch;
+
+	// weights as [F/B][C/B][KH][KW][B in][B out] for the blocked layouts, zero padded, with the
+	// biases padded to whole blocks. Packed on first use after initialize.
+	std::vector<float> blocked_weights;
+	std::vector<float> blocked_biases;
+
+	// int8 scratch, one quantized image and row matrix per thread
+	std::vector<int8_t> quantized_input;
+	std::vector<int8_t> quantized_rows;
+
+	ConvGeometry geometry() const {
+		return { input_shape[1], input_shape[2], input_shape[3],
+				 filter_height, filter_width, stride, padding,
+				 output_shape[2], output_shape[3] };
+	}
+
 	Tensor applyPadding() const {
 		if (!padding) return *input;
 		const std::vector<size_t> input_shape = input->getShape();
@@ -40,40 +88,466 @@ public:
 		padding(padding)
 	{
 	}
+
+	const char* getType() const override {
+		return "Conv";
+	}
+
+	std::vector<double> getHyperparameters() const override {
+		return { double(num_filters), double(filter_width), double(filter_height), double(stride), double(padding) };
+	}
+
+	void setAlgorithm(ALGORITHMS _algorithm) {
+		algorithm = _algorithm;
+		if (output_shape.size()) selected_algorithm = selectAlgorithm();
+	}
+
+	ALGORITHMS getAlgorithm() const {
+		return selected_algorithm;
+	}
+
+	bool fusesActivation() const override {
+		return hasFusableActivation();
+	}
+
+	// direct convolution counts, whichever algorithm runs, so GFLOP/s compare across algorithms
+	Cost forwardCost() const override {
+		const double macs = elements(output_shape) * input_shape[1] * filter_height * filter_width;
+		return { 2 * macs, (elements(input_shape) + elements(output_shape)) * sizeof(float) + kernelWeightBytes() };
+	}
+
+	// input and filter gradients, reading dY, X and W and writing dX and dW
+	Cost backwardCost() const override {
+		const double macs = elements(output_shape) * input_shape[1] * filter_height * filter_width;
+		return { 4 * macs, (elements(output_shape) + 2 * elements(input_shape) + weights.data.size()) * sizeof(float) + kernelWeightBytes() };
+	}
+
+	// only the im2col and pointwise GEMMs read the 16 bit weights, the direct, Winograd and
+	// blocked kernels keep reading the fp32 weights
+	bool supportsHalfPrecision() const override {
+		return true;
+	}
 	
 	void initialize(std::vector<size_t> is) override {
 		input_shape = is;
-		weights = Tensor({ num_filters, input_shape[1], filter_width, filter_height});
-		biases = Tensor({ num_filters });
+		std::vector<size_t> weight_shape = { num_filters, input_shape[1], filter_height, filter_width };
 
 		size_t outh = (input_shape[2] + 2 * padding - filter_height) / stride + 1;
 		size_t outw = (input_shape[3] + 2 * padding - filter_width) / stride + 1;
 
-		size_t filter_size = weights.data.size();
+		size_t filter_size = input_shape[1] * filter_height * filter_width * num_filters;
 		size_t output_size = num_filters * outh * outw;
 
 		output_shape = { input_shape[0], num_filters, outh, outw };
+		selected_algorithm = selectAlgorithm();
+		blocked_weights.clear();
+		winograd_source.clear();
 
-		switch (activation_function) {
-		case (ActivationFunctions::TYPES::RELU):
-			Initializer::he_init(weights, filter_size);
-			break;
+		if (!useLoadedParameters(weight_shape, { num_filters })) {
+			weights = Tensor(weight_shape);
+			biases = Tensor({ num_filters });
 
-		case (ActivationFunctions::TYPES::SIGMOID):
-		case(ActivationFunctions::TYPES::SOFTMAX):
-			Initializer::xavier_init(weights, filter_size, output_size);
-			break;
+			switch (activation_function) {
+			case (ActivationFunctions::TYPES::RELU):
+				Initializer::he_init(weights, filter_size);
+				break;
 
-		default:
-			Initializer::uniform(weights, filter_size);
-			break;
+			case (ActivationFunctions::TYPES::SIGMOID):
+			case(ActivationFunctions::TYPES::SOFTMAX):
+				Initializer::xavier_init(weights, filter_size, output_size);
+				break;
+
+			default:
+				Initializer::uniform(weights, filter_size);
+				break;
+			}
 		}
 
-		weight_gradient = new Tensor(weights.getShape());
-		bias_gradient = new Tensor({ num_filters });
+		initGradients();
+	}
+
+	bool supportsLayout(Layout::TYPES _layout) const override {
+		return _layout == Layout::NCHW || Layout::isBlocked(_layout);
+	}
+
+	void setLayout(Layout::TYPES _layout) override {
+		if (_layout != layout) blocked_weights.clear();
+		layout = _layout;
+	}
+
+	// the int8 kernels read NCHW
+	bool supportsQuantization() const override {
+		return layout == Layout::NCHW;
+	}
+
+	// one scale per filter over its C x KH x KW weights
+	void quantize(float input_range) override {
+		const size_t depth = weights.data.size() / num_filters;
+		quantized_weights = Int8Gemm::quantizeWeights(weights.data.data(), num_filters, depth, depth, 1);
+		input_scale = input_range > 0.0f ? input_range / 127.0f : 1.0f;
 	}
 
 	void forward() override {
+		if (layout == Layout::NCHW8C) forwardBlocked<8>();
+		else if (layout == Layout::NCHW16C) forwardBlocked<16>();
+		else if (isQuantized()) forwardInt8();
+		else if (isWinograd()) forwardWinograd();
+		else if (selected_algorithm == IM2COL) forwardIm2Col();
+		else forwardDirect();
+	}
+
+	// Winograd computes the input gradient, the weight gradient still goes through im2col
+	void backward(const Tensor& gradOutput) override {
+		const Tensor& grad = preActivationGradient(gradOutput);
+
+		if (selected_algorithm == DIRECT) {
+			backwardDirect(grad);
+		}
+		else {
+			backwardIm2Col(grad, !isWinograd());
+			if (isWinograd()) backwardDataWinograd(grad);
+		}
+	}
+
+private:
+	ALGORITHMS selectAlgorithm() const {
+		const ConvGeometry g = geometry();
+		const bool winograd_shape = filter_height == 3 && filter_width == 3 && stride == 1 && padding <= 2;
+
+		if (algorithm == WINOGRAD_2X2 || algorithm == WINOGRAD_4X4) {
+			if (!winograd_shape) {
+				throw std::invalid_argument("Winograd convolution needs 3x3 filters, stride 1 and padding of at most 2.");
+			}
+			return algorithm;
+		}
+		if (algorithm != AUTO) return algorithm;
+
+		if (g.colRows() * g.colCols() > IM2COL_MAX_COLUMN) return DIRECT;
+
+		// the transforms only pay off against the GEMMs with enough channels on both sides,
+		// F(4x4) tiles need outputs of at least 4x4
+		if (winograd_shape && std::min(input_shape[1], num_filters) >= WINOGRAD_MIN_CHANNELS) {
+			const ALGORITHMS winograd = g.out_h >= 4 && g.out_w >= 4 ? WINOGRAD_4X4 : WINOGRAD_2X2;
+			const size_t m = winogradTile(winograd);
+			if (Winograd::scratchSize(g, num_filters, m, Winograd::groupSize(g, m)) <= IM2COL_MAX_COLUMN) return winograd;
+		}
+
+		return IM2COL;
+	}
+
+	double kernelWeightBytes() const {
+		return selected_algorithm == IM2COL && layout == Layout::NCHW ? weightBytes() : weights.data.size() * sizeof(float);
+	}
+
+	bool isWinograd() const {
+		return selected_algorithm == WINOGRAD_2X2 || selected_algorithm == WINOGRAD_4X4;
+	}
+
+	static size_t winogradTile(ALGORITHMS winograd) {
+		return winograd == WINOGRAD_4X4 ? 4 : 2;
+	}
+
+	// recomputes the transformed filters when the weights changed since the last call
+	void updateWinogradFilters() {
+		if (winograd_source.size() == weights.data.size() &&
+			std::equal(winograd_source.begin(), winograd_source.end(), weights.data.begin())) {
+			return;
+		}
+
+		const size_t C = input_shape[1];
+		const size_t m = winogradTile(selected_algorithm);
+
+		winograd_source.assign(weights.data.begin(), weights.data.end());
+		winograd_filters.resize(Winograd::filterSize(num_filters, C, m));
+		Winograd::transformFilters(weights.data.data(), num_filters, C, C * 9, 9, false, m, winograd_filters.data());
+		winograd_data_filters.clear();
+	}
+
+	void forwardWinograd() {
+		updateWinogradFilters();
+		winogradConvolve(*input, geometry(), num_filters, winograd_filters, *output, epilogue(biases.data.data(), true));
+	}
+
+	// dX is the convolution of dY, padded by 2 - padding, with the filters rotated by 180
+	// degrees and their filter and channel axes swapped
+	void backwardDataWinograd(const Tensor& gradOutput) {
+		const ConvGeometry g = geometry();
+		const ConvGeometry gt = { num_filters, g.out_h, g.out_w, 3, 3, 1, 2 - padding, g.height, g.width };
+		const size_t C = input_shape[1];
+		const size_t m = winogradTile(selected_algorithm);
+
+		updateWinogradFilters();
+		if (winograd_data_filters.empty()) {
+			winograd_data_filters.resize(Winograd::filterSize(C, num_filters, m));
+			Winograd::transformFilters(weights.data.data(), C, num_filters, 9, C * 9, true, m, winograd_data_filters.data());
+		}
+
+		winogradConvolve(gradOutput, gt, C, winograd_data_filters, *input_gradient);
+	}
+
+	// runs Winograd::convolve over groups of images, one group per thread at a time
+	void winogradConvolve(const Tensor& in, const ConvGeometry& g, size_t filters, const std::vector<float>& U,
+						  Tensor& out, const Gemm::Epilogue& e = Gemm::Epilogue())
+	{
+		const size_t m = winogradTile(selected_algorithm);
+		const size_t batches = input_shape[0];
+		const size_t in_size = in.getStrides()[0];
+		const size_t out_size = out.getStrides()[0];
+		const size_t group = std::min(batches, Winograd::groupSize(g, m));
+		const size_t groups = (batches + group - 1) / group;
+		const size_t scratch = Winograd::scratchSize(g, filters, m, group);
+
+		const size_t threads = std::min<size_t>(Parallel::maxThreads(), groups);
+		winograd_scratch.resize(std::max(winograd_scratch.size(), threads * scratch));
+
+#pragma omp parallel for num_threads(threads) schedule(static) if(threads > 1)
+		for (size_t i = 0; i < groups; i++) {
+			const size_t b = i * group;
+			Winograd::convolve(in.data.data() + b * in_size, std::min(group, batches - b), in_size, g,
+				filters, m, U.data(), out.data.data() + b * out_size, out_size,
+				winograd_scratch.data() + Parallel::threadId() * scratch, e);
+		}
+	}
+
+	// Lowers each image to a column matrix so the convolution becomes
+	// output[F x OH*OW] = weights[F x C*KH*KW] * columns[C*KH*KW x OH*OW],
+	// with bias and activation applied in the GEMM epilogue
+	void forwardIm2Col() {
+		const ConvGeometry g = geometry();
+		const size_t batches = input_shape[0];
+		const size_t rows = g.colRows();
+		const size_t cols = g.colCols();
+		const size_t in_size = input->getStrides()[0];
+		const size_t out_size = output->getStrides()[0];
+
+		// with several images each thread takes whole images and runs a serial GEMM,
+		// a single image uses the multithreaded GEMM instead
+		const size_t threads = std::min<size_t>(Parallel::maxThreads(), batches);
+		if (!g.isPointwise()) columns.resize(std::max(columns.size(), threads * rows * cols));
+
+#pragma omp parallel for num_threads(threads) schedule(static) if(threads > 1)
+		for (size_t b = 0; b < batches; b++) {
+			const float* col = input->data.data() + b * in_size;
+
+			if (!g.isPointwise()) {
+				float* buffer = columns.data() + Parallel::threadId() * rows * cols;
+				Im2Col::im2col(col, g, buffer);
+				col = buffer;
+			}
+
+			withWeights([&](auto w) {
+				Gemm::gemm(false, false, num_filters, cols, rows,
+					1.0f, w, rows, col, cols,
+					0.0f, output->data.data() + b * out_size, cols,
+					epilogue(biases.data.data(), true));
+			});
+		}
+	}
+
+	// Direct convolution in a blocked layout (inference only). Each output pixel accumulates a full
+	// block of B output channels as one vector, fed by B input channels at a time, for up to
+	// OW_BLOCK neighbouring pixels so that each weight vector is reused across them.
+	template <size_t B>
+	void forwardBlocked() {
+		static const size_t OW_BLOCK = 4;
+
+		const size_t batches = input_shape[0];
+		const size_t H = input_shape[2], W = input_shape[3];
+		const size_t OH = output_shape[2], OW = output_shape[3];
+		const size_t in_blocks = (input_shape[1] + B - 1) / B;
+		const size_t out_blocks = (num_filters + B - 1) / B;
+
+		if (blocked_weights.empty()) packBlockedWeights(B);
+
+		const float* in = input->data.data();
+		float* out = output->data.data();
+
+#pragma omp parallel for collapse(3)
+		for (size_t n = 0; n < batches; n++) {
+			for (size_t fb = 0; fb < out_blocks; fb++) {
+				for (size_t oh = 0; oh < OH; oh++) {
+					const float* bias = blocked_biases.data() + fb * B;
+					float* dst = out + ((n * out_blocks + fb) * OH + oh) * OW * B;
+
+					for (size_t ow = 0; ow < OW; ow += OW_BLOCK) {
+						const size_t count = std::min(OW_BLOCK, OW - ow);
+
+						float acc[OW_BLOCK][B];
+						for (size_t r = 0; r < OW_BLOCK; r++) std::copy(bias, bias + B, acc[r]);
+
+						for (size_t cb = 0; cb < in_blocks; cb++) {
+							const float* plane = in + (n * in_blocks + cb) * H * W * B;
+
+							for (size_t kh = 0; kh < filter_height; kh++) {
+								long long ih = static_cast<long long>(oh * stride + kh) - static_cast<long long>(padding);
+								if (ih < 0 || ih >= static_cast<long long>(H)) continue;
+
+								for (size_t kw = 0; kw < filter_width; kw++) {
+									const float* w = blocked_weights.data() + (((fb * in_blocks + cb) * filter_height + kh) * filter_width + kw) * B * B;
+
+									for (size_t r = 0; r < count; r++) {
+										long long iw = static_cast<long long>((ow + r) * stride + kw) - static_cast<long long>(padding);
+										if (iw < 0 || iw >= static_cast<long long>(W)) continue;
+
+										const float* x = plane + (ih * W + iw) * B;
+										for (size_t ci = 0; ci < B; ci++) {
+											const float xv = x[ci];
+											for (size_t co = 0; co < B; co++) acc[r][co] += xv * w[ci * B + co];
+										}
+									}
+								}
+							}
+						}
+
+						for (size_t r = 0; r < count; r++) {
+							for (size_t co = 0; co < B; co++) {
+								dst[(ow + r) * B + co] = activate(acc[r][co]);
+							}
+						}
+					}
+				}
+			}
+		}
+	}
+
+	void packBlockedWeights(size_t B) {
+		const size_t C = input_shape[1];
+		const size_t in_blocks = (C + B - 1) / B;
+		const size_t out_blocks = (num_filters + B - 1) / B;
+		const size_t taps = filter_height * filter_width;
+
+		blocked_weights.assign(out_blocks * in_blocks * taps * B * B, 0.0f);
+		blocked_biases.assign(out_blocks * B, 0.0f);
+
+		for (size_t f = 0; f < num_filters; f++) {
+			blocked_biases[f] = biases.data[f];
+
+			for (size_t c = 0; c < C; c++) {
+				for (size_t t = 0; t < taps; t++) {
+					size_t dst = (((f / B) * in_blocks + c / B) * taps + t) * B * B + (c % B) * B + f % B;
+					blocked_weights[dst] = weights.data[(f * C + c) * taps + t];
+				}
+			}
+		}
+	}
+
+	// INT8 inference: each image is quantized and lowered with im2row to an (OH*OW) x (C*KH*KW)
+	// int8 matrix, so that every output is a dot product with one row of the int8 weights.
+	// The GEMM writes its (OH*OW) x F result transposed, straight into the NCHW output.
+	void forwardInt8() {
+		const ConvGeometry g = geometry();
+		const size_t batches = input_shape[0];
+		const size_t depth = quantized_weights.padded_depth;
+		const size_t cols = g.colCols();
+		const size_t in_size = input->getStrides()[0];
+		const size_t out_size = output->getStrides()[0];
+
+		const size_t threads = std::min<size_t>(Parallel::maxThreads(), batches);
+		quantized_input.resize(threads * in_size);
+		quantized_rows.resize(threads * cols * depth);
+
+#pragma omp parallel for num_threads(threads) schedule(static) if(threads > 1)
+		for (size_t b = 0; b < batches; b++) {
+			int8_t* image = quantized_input.data() + Parallel::threadId() * in_size;
+			int8_t* rows = quantized_rows.data() + Parallel::threadId() * cols * depth;
+
+			Int8Gemm::quantize(input->data.data() + b * in_size, in_size, input_scale, image);
+			Im2Col::im2row(image, g, rows, depth);
+
+			Int8Gemm::gemm(cols, rows, input_scale, quantized_weights,
+				output->data.data() + b * out_size, 1, cols,
+				epilogue(biases.data.data(), true));
+		}
+	}
+
+	// dX = col2im(W^T * dY) per image; dW = sum over images of dY * columns^T, accumulated
+	// into one partial per thread and reduced afterwards so images can run in parallel.
+	// dX is skipped when input_gradients is false.
+	void backwardIm2Col(const Tensor& gradOutput, bool input_gradients = true) {
+		const ConvGeometry g = geometry();
+		const size_t batches = input_shape[0];
+		const size_t rows = g.colRows();
+		const size_t cols = g.colCols();
+		const size_t in_size = input->getStrides()[0];
+		const size_t out_size = gradOutput.getStrides()[0];
+		const size_t weight_size = weights.data.size();
+
+		const size_t threads = std::min<size_t>(Parallel::maxThreads(), batches);
+		if (!g.isPointwise()) {
+			columns.resize(std::max(columns.size(), threads * rows * cols));
+			if (input_gradients) column_gradient.resize(threads * rows * cols);
+		}
+
+		// a single thread accumulates straight into weight_gradient
+		float* partials = weight_gradient->data.data();
+		if (threads > 1) {
+			weight_partials.resize(threads * weight_size);
+			partials = weight_partials.data();
+		}
+		std::fill(partials, partials + threads * weight_size, 0.0f);
+
+#pragma omp parallel for num_threads(threads) schedule(static) if(threads > 1)
+		for (size_t b = 0; b < batches; b++) {
+			const size_t t = Parallel::threadId();
+			const float* image = input->data.data() + b * in_size;
+			const float* dy = gradOutput.data.data() + b * out_size;
+			float* dx = input_gradient->data.data() + b * in_size;
+
+			const float* col = image;
+			if (!g.isPointwise()) {
+				float* buffer = columns.data() + t * rows * cols;
+				Im2Col::im2col(image, g, buffer);
+				col = buffer;
+			}
+
+			Gemm::sgemm(false, true, num_filters, rows, cols,
+				1.0f, dy, cols, col, cols,
+				1.0f, partials + t * weight_size, rows);
+
+			if (!input_gradients) continue;
+
+			// dX is written directly by a pointwise convolution, through a column matrix otherwise
+			float* dcol = g.isPointwise() ? dx : column_gradient.data() + t * rows * cols;
+			withWeights([&](auto w) {
+				Gemm::gemm(true, false, rows, cols, num_filters,
+					1.0f, w, rows, dy, cols,
+					0.0f, dcol, cols);
+			});
+
+			if (!g.isPointwise()) {
+				std::fill(dx, dx + in_size, 0.0f);
+				Im2Col::col2im(dcol, g, dx);
+			}
+		}
+
+		if (threads > 1) {
+#pragma omp parallel for
+			for (size_t i = 0; i < weight_size; i++) {
+				float sum = 0.0f;
+				for (size_t t = 0; t < threads; t++) sum += partials[t * weight_size + i];
+				weight_gradient->data[i] = sum;
+			}
+		}
+
+		biasGradient(gradOutput);
+	}
+
+	void biasGradient(const Tensor& gradOutput) {
+		const size_t cols = output_shape[2] * output_shape[3];
+		const size_t out_size = gradOutput.getStrides()[0];
+
+#pragma omp parallel for
+		for (size_t f = 0; f < num_filters; f++) {
+			float sum = 0.0f;
+			for (size_t b = 0; b < input_shape[0]; b++) {
+				const float* dy = gradOutput.data.data() + b * out_size + f * cols;
+				for (size_t p = 0; p < cols; p++) sum += dy[p];
+			}
+			bias_gradient->data[f] = sum;
+		}
+	}
+
+	void forwardDirect() {
 		size_t output_height = output->getShape()[2];
 		size_t output_width = output->getShape()[3];
 
@@ -88,17 +562,14 @@ public:
 					for (size_t w = 0; w < output_width; w++) {
 						float sum = 0.0f;
 
-						size_t h_start = h * stride;
-						size_t w_start = w * stride;
-
 						for (size_t c = 0; c < input_shape[1]; c++) {
 							for (size_t fh = 0; fh < filter_height; fh++) {
-								size_t h_index = h_start + fh;
-								if (h_index >= input_shape[2]) continue;
+								size_t h_index;
+								if (!inputIndex(h, fh, input_shape[2], h_index)) continue;
 
 								for (size_t fw = 0; fw < filter_width; fw++) {
-									size_t w_index = w_start + fw;
-									if (w_index >= input_shape[3]) continue;
+									size_t w_index;
+									if (!inputIndex(w, fw, input_shape[3], w_index)) continue;
 
 									sum += weights.data[f * ws[0] + c * ws[1] + fh * ws[2] + fw * ws[3]] * 
 											input->data[b * is[0] + c * is[1] + h_index * is[2] + w_index * is[3]];
@@ -106,78 +577,93 @@ public:
 							}
 						}
 
-						output->data[b * os[0] + f * os[1] + h * os[2] + w * os[3]] = sum + biases.data[f];
+						output->data[b * os[0] + f * os[1] + h * os[2] + w * os[3]] = activate(sum + biases.data[f]);
 					}
 				}
 			}
 		}
 	}
 
-	void backward(const Tensor& gradOutput) override {
-		input_gradient->zero();
-		weight_gradient->zero();
-		bias_gradient->zero();
-
+	void backwardDirect(const Tensor& gradOutput) {
 		const std::vector<size_t>& ws = weights.getStrides();
 		const std::vector<size_t>& is = input->getStrides();
 		const std::vector<size_t>& gos = gradOutput.getStrides();
-		const std::vector<size_t>& igs = input_gradient->getStrides();
-		const std::vector<size_t>& wgs = weight_gradient->getStrides();
-		const std::vector<size_t>& bgs = bias_gradient->getStrides();
 
-#pragma omp parallel for collapse(6);
+		// backward data as a transposed convolution: every input pixel gathers only the
+		// outputs whose window covers it, O(input x filter) instead of O(input x output)
+#pragma omp parallel for collapse(2)
 		for (size_t b = 0; b < input_shape[0]; b++) {
 			for (size_t c = 0; c < input_shape[1]; c++) {
 				for (size_t i = 0; i < input_shape[2]; i++) {
 					for (size_t j = 0; j < input_shape[3]; j++) {
+						float sum = 0.0f;
+
 						for (size_t o = 0; o < num_filters; o++) {
-							for (size_t p = 0; p < output_shape[2]; p++) {
-								for (size_t q = 0; q < output_shape[3]; q++) {
-									size_t h_start = p * stride;
-									size_t w_start = q * stride;
-									if (i >= h_start && i < h_start + filter_height &&
-										j >= w_start && j < w_start + filter_width) {
-										size_t fh = i - h_start;
-										size_t fw = j - w_start;
-										
-										input_gradient->data[b * igs[0] + c * igs[1] + i * igs[2] + j * igs[3]] +=
-											gradOutput.data[b * gos[0] + o * gos[1] + p * gos[2] + q * gos[3]] *
-											weights.data[o * ws[0] + c * ws[1] + fh * ws[2] + fw * ws[3]];
-									}
+							for (size_t fh = 0; fh < filter_height; fh++) {
+								size_t p;
+								if (!outputIndex(i, fh, output_shape[2], p)) continue;
+
+								for (size_t fw = 0; fw < filter_width; fw++) {
+									size_t q;
+									if (!outputIndex(j, fw, output_shape[3], q)) continue;
+
+									sum += gradOutput.data[b * gos[0] + o * gos[1] + p * gos[2] + q * gos[3]] *
+										weights.data[o * ws[0] + c * ws[1] + fh * ws[2] + fw * ws[3]];
 								}
 							}
 						}
+
+						input_gradient->data[b * is[0] + c * is[1] + i * is[2] + j * is[3]] = sum;
 					}
 				}
-			}	
+			}
 		}
 
+		// backward filter: each (o, c) pair owns its own slice of the weight gradient
+#pragma omp parallel for collapse(2)
 		for (size_t o = 0; o < num_filters; o++) {
 			for (size_t c = 0; c < input_shape[1]; c++) {
 				for (size_t fh = 0; fh < filter_height; fh++) {
 					for (size_t fw = 0; fw < filter_width; fw++) {
+						float sum = 0.0f;
+
 						for (size_t b = 0; b < input_shape[0]; b++) {
 							for (size_t p = 0; p < output_shape[2]; p++) {
+								size_t i;
+								if (!inputIndex(p, fh, input_shape[2], i)) continue;
+
 								for (size_t q = 0; q < output_shape[3]; q++) {
-									weight_gradient->data[o * wgs[0] + c * wgs[1] + fh * wgs[2] + fw * wgs[3]] +=
-										gradOutput.data[b * gos[0] + o * gos[1] + p * gos[2] + q * gos[3]] * 
-										input->data[b * is[0] + c * is[1] + (p * stride + fh) * is[2] + (q * stride + fw) * is[3]];
+									size_t j;
+									if (!inputIndex(q, fw, input_shape[3], j)) continue;
+
+									sum += gradOutput.data[b * gos[0] + o * gos[1] + p * gos[2] + q * gos[3]] * 
+										input->data[b * is[0] + c * is[1] + i * is[2] + j * is[3]];
 								}
 							}
 						}
-					}
-				}
-			}
-		}
 
-		for (size_t o = 0; o < num_filters; o++) {
-			for (size_t b = 0; b < input_shape[0]; b++) {
-				for (size_t p = 0; p < output_shape[2]; p++) {
-					for (size_t q = 0; q < output_shape[3]; q++) {
-						bias_gradient->data[o] += gradOutput.data[b * gos[0] + o * gos[1] + p * gos[2] + q * gos[3]];
+						weight_gradient->data[o * ws[0] + c * ws[1] + fh * ws[2] + fw * ws[3]] = sum;
 					}
 				}
 			}
 		}
+
+		biasGradient(gradOutput);
+	}
+
+	// input row/column read by output position out at filter offset k, false when it falls in the padding
+	bool inputIndex(size_t out, size_t k, size_t size, size_t& index) const {
+		size_t shifted = out * stride + k;
+		if (shifted < padding || shifted - padding >= size) return false;
+		index = shifted - padding;
+		return true;
+	}
+
+	// output row/column whose window reads input position in at filter offset k, if any
+	bool outputIndex(size_t in, size_t k, size_t size, size_t& index) const {
+		size_t shifted = in + padding;
+		if (shifted < k || (shifted - k) % stride) return false;
+		index = (shifted - k) / stride;
+		return index < size;
 	}
 };
\ No newline at end of file
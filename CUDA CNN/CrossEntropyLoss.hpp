@@ -1,32 +1,118 @@
 #pragma once
 
 #include "Loss.hpp"
+#include "VectorMath.hpp"
 #include <cmath>
 
+// Cross entropy of class probabilities. Labels are either one-hot rows shaped like the predictions,
+// or sparse: one class index per sample, shaped { samples } or { samples, 1 }.
 class CrossEntropyLoss : public Loss {
 public: 
 	float compute(const Tensor& labels, const Tensor& predictions) override {
+		const size_t rows = predictions.getShape()[0];
+		const size_t classes = predictions.data.size() / rows;
+		const bool sparse = isSparse(labels, predictions);
 		float loss = 0.0f;
 
-		if (labels.getShape() != predictions.getShape()) {
-			throw std::out_of_range("Labels and Predictions size do not match.");
-		}
-		
-		for (size_t i = 0; i < labels.getShape()[0]; i++) {
-			for (size_t j = 0; j < labels.getShape()[1]; j++) {
-				const float p = std::max(std::min(predictions({ i, j }), 1.0f - 1e-12f), 1e-12f);
-				loss += labels({ i, j }) > 0 ? std::log(p) : 0;
+#pragma omp parallel for reduction(+:loss)
+		for (size_t i = 0; i < rows; i++) {
+			const float* p = predictions.data.data() + i * classes;
+
+			if (sparse) {
+				loss += std::log(clamp(p[classIndex(labels, i)]));
+				continue;
+			}
+
+			for (size_t j = 0; j < classes; j++) {
+				if (labels.data[i * classes + j] > 0) loss += std::log(clamp(p[j]));
 			}
 		}
 
-		return -loss / labels.getShape()[0];
+		return -loss / rows;
 	};
 
 	Tensor backward(const Tensor& labels, const Tensor& predictions) override {
-		if (labels.getShape() != predictions.getShape()) {
+		if (!isSparse(labels, predictions)) return predictions - labels;
+
+		const size_t rows = predictions.getShape()[0];
+		const size_t classes = predictions.data.size() / rows;
+
+		Tensor gradient = predictions;
+		for (size_t i = 0; i < rows; i++) gradient.data[i * classes + classIndex(labels, i)] -= 1.0f;
+		return gradient;
+	};
+
+	bool fusesSoftmax() const override {
+		return true;
+	}
+
+	// One pass per row: the softmax of the row is written to gradient, the loss taken from the
+	// log-sum-exp of the logits, lse - logit of the class, and the label subtracted in place.
+	// Rows run in parallel.
+	float computeFromLogits(const Tensor& labels, const Tensor& logits, Tensor& gradient) override {
+		const size_t rows = logits.getShape()[0];
+		const size_t classes = logits.data.size() / rows;
+		const bool sparse = isSparse(labels, logits);
+		float loss = 0.0f;
+
+#pragma omp parallel for reduction(+:loss) if(logits.data.size() >= VectorMath::BLOCK && rows > 1 && !Parallel::inParallel())
+		for (size_t i = 0; i < rows; i++) {
+			const float* z = logits.data.data() + i * classes;
+			float* g = gradient.data.data() + i * classes;
+
+			// softmaxRow may overwrite z when gradient aliases logits, the label logits are read first
+			if (sparse) {
+				const size_t c = classIndex(labels, i);
+				const float target = z[c];
+
+				loss += VectorMath::softmaxRow(z, g, classes) - target;
+				g[c] -= 1.0f;
+				continue;
+			}
+
+			const float* l = labels.data.data() + i * classes;
+			float target = 0.0f, count = 0.0f;
+			for (size_t j = 0; j < classes; j++) {
+				target += l[j] > 0 ? z[j] : 0.0f;
+				count += l[j] > 0 ? 1.0f : 0.0f;
+			}
+
+			loss += count * VectorMath::softmaxRow(z, g, classes) - target;
+			for (size_t j = 0; j < classes; j++) g[j] -= l[j];
+		}
+
+		return loss / rows;
+	}
+
+private:
+	static float clamp(float p) {
+		return std::max(std::min(p, 1.0f - 1e-12f), 1e-12f);
+	}
+
+	// Sparse labels hold one value per sample, one-hot labels one per class. Sparse labels are
+	// checked here, before the parallel loops index with them.
+	static bool isSparse(const Tensor& labels, const Tensor& predictions) {
+		const size_t rows = predictions.getShape()[0];
+		const size_t classes = predictions.data.size() / rows;
+
+		if (labels.getShape()[0] != rows) {
+			throw std::out_of_range("Labels and Predictions size do not match.");
+		}
+		if (labels.data.size() == predictions.data.size()) return false;
+		if (labels.data.size() != rows) {
 			throw std::out_of_range("Labels and Predictions size do not match.");
 		}
 
-		return predictions - labels;
-	};
+		for (float label : labels.data) {
+			if (!(label >= 0.0f && label < classes) || label != std::floor(label)) {
+				throw std::out_of_range("Sparse labels must be class indices.");
+			}
+		}
+
+		return true;
+	}
+
+	static size_t classIndex(const Tensor& labels, size_t row) {
+		return static_cast<size_t>(labels.data[row]);
+	}
 };
\ No newline at end of file
@@ -7,9 +7,20 @@ private:
 	size_t output_size;
 	size_t input_size = 0;
 
+	// int8 copy of the input, rows padded to the quantized weight depth
+	std::vector<int8_t> quantized_input;
+
 public: 
 	DenseLayer(size_t output_size, ActivationFunctions::TYPES _ac = ActivationFunctions::TYPES::NONE) : Layer(_ac), output_size(output_size) {}
 
+	const char* getType() const override {
+		return "Dense";
+	}
+
+	std::vector<double> getHyperparameters() const override {
+		return { double(output_size) };
+	}
+
 	void initialize(std::vector<size_t> is) override {
 		input_shape = is;
 		output_shape = { input_shape[0], output_size};
@@ -18,55 +29,103 @@ public:
 		size_t _is = input_size;
 		size_t _os = output_size;
 
-		weights = Tensor({ input_size, output_size });
-		biases = Tensor({ output_size });
-
-		switch (activation_function) {
-		case (ActivationFunctions::TYPES::RELU):
-			Initializer::he_init(weights, _is);
-			break;
-
-		case (ActivationFunctions::TYPES::SIGMOID):
-		case(ActivationFunctions::TYPES::SOFTMAX):
-			Initializer::xavier_init(weights, _is, _os);
-			break;
-		case (ActivationFunctions::TYPES::SOFTMAX_CEL):
-			Initializer::final_layer_init(weights, _is);
-			break;
-		default:
-			Initializer::uniform(weights, _is);
-			break;
+		if (!useLoadedParameters({ input_size, output_size }, { output_size })) {
+			weights = Tensor({ input_size, output_size });
+			biases = Tensor({ output_size });
+
+			switch (activation_function) {
+			case (ActivationFunctions::TYPES::RELU):
+				Initializer::he_init(weights, _is);
+				break;
+
+			case (ActivationFunctions::TYPES::SIGMOID):
+			case(ActivationFunctions::TYPES::SOFTMAX):
+				Initializer::xavier_init(weights, _is, _os);
+				break;
+			case (ActivationFunctions::TYPES::SOFTMAX_CEL):
+				Initializer::final_layer_init(weights, _is);
+				break;
+			default:
+				Initializer::uniform(weights, _is);
+				break;
+			}
 		}
 
-		weight_gradient = new Tensor({ input_size, output_size });
-		bias_gradient = new Tensor({ output_size });
+		initGradients();
+	}
+
+	bool fusesActivation() const override {
+		return hasFusableActivation();
+	}
+
+	Cost forwardCost() const override {
+		const double macs = double(input_shape[0]) * input_size * output_size;
+		return { 2 * macs, (elements(input_shape) + elements(output_shape)) * sizeof(float) + weightBytes() };
+	}
+
+	// input and weight gradients, reading dY, X and W and writing dX and dW
+	Cost backwardCost() const override {
+		const double macs = double(input_shape[0]) * input_size * output_size;
+		return { 4 * macs, (elements(output_shape) + 2 * elements(input_shape) + weights.data.size()) * sizeof(float) + weightBytes() };
+	}
+
+	bool supportsHalfPrecision() const override {
+		return true;
+	}
+
+	bool supportsQuantization() const override {
+		return true;
+	}
+
+	// one scale per output neuron, i.e. per column of the input_size x output_size weights
+	void quantize(float input_range) override {
+		quantized_weights = Int8Gemm::quantizeWeights(weights.data.data(), output_size, input_size, 1, output_size);
+		input_scale = input_range > 0.0f ? input_range / 127.0f : 1.0f;
 	}
 
 	void forward() override {
-		for (size_t b = 0; b < input_shape[0]; b++) {
-			for (size_t i = 0; i < output_size; i++) {
-				float sum = biases.data[i];
-				for (size_t j = 0; j < input_size; j++) {
-					sum += input->data[b * input_size + j] * weights.data[j * output_size + i];
-				}
-				output->data[b * output_size + i] = sum;
-			}
+		if (isQuantized()) {
+			forwardInt8();
+			return;
 		}
+
+		// output = activation(input * weights + biases)
+		const size_t batches = input_shape[0];
+		withWeights([&](auto w) {
+			Gemm::gemm(false, false, batches, output_size, input_size,
+				1.0f, input->data.data(), input_size, w, output_size,
+				0.0f, output->data.data(), output_size, epilogue(biases.data.data(), false));
+		});
 	}
 
 	void backward(const Tensor& gradOutput) override {
-		input_gradient->zero();
-		weight_gradient->zero();
+		const Tensor& grad = preActivationGradient(gradOutput);
+
+		// dW = input^T * dY, dX = dY * weights^T
+		Tensor::matmul(*input, true, grad, false, *weight_gradient);
+		withWeights([&](auto w) {
+			Gemm::gemm(false, true, input_shape[0], input_size, output_size,
+				1.0f, grad.data.data(), output_size, w, output_size,
+				0.0f, input_gradient->data.data(), input_size);
+		});
+
 		bias_gradient->zero();
-		
 		for (size_t b = 0; b < input_shape[0]; b++) {
 			for (size_t i = 0; i < output_size; i++) {
-				bias_gradient->data[i] += gradOutput.data[b * output_size + i];
-				for (size_t j = 0; j < input_size; j++) {
-					weight_gradient->data[j * output_size + i] += input->data[b * input_size + j] * gradOutput.data[b * output_size + i];
-					input_gradient->data[b * input_size + j] += weights.data[j * output_size + i] * gradOutput.data[b * output_size + i];
-				}
+				bias_gradient->data[i] += grad.data[b * output_size + i];
 			}
 		}
 	}
+
+private:
+	// output = activation(dequantize(int8(input) * int8(weights)) + biases)
+	void forwardInt8() {
+		const size_t batches = input_shape[0];
+		const size_t depth = quantized_weights.padded_depth;
+		quantized_input.resize(batches * depth);
+
+		Int8Gemm::quantizeRows(input->data.data(), batches, input_size, input_size, input_scale, quantized_input.data(), depth);
+		Int8Gemm::gemm(batches, quantized_input.data(), input_scale, quantized_weights,
+			output->data.data(), output_size, 1, epilogue(biases.data.data(), false));
+	}
 };
\ No newline at end of file
@@ -1,3 +1,5 @@
+#pragma once
+
 #include "Layer.hpp"
 
 class DropoutLayer : public Layer {
@@ -6,6 +8,14 @@ private:
 public:
 	DropoutLayer(float p) : Layer(), p(p) {}
 
+	const char* getType() const override {
+		return "Dropout";
+	}
+
+	std::vector<double> getHyperparameters() const override {
+		return { double(p) };
+	}
+
 	void initialize(std::vector<size_t> input_shape) {};
 	void forward() {};
 	void backward(const Tensor& gradOutput) {}
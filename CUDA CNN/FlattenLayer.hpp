@@ -7,6 +7,10 @@ class FlattenLayer : public Layer {
 public:
     FlattenLayer() : Layer(ActivationFunctions::TYPES::NONE) {}
 
+    const char* getType() const override {
+        return "Flatten";
+    }
+
     void initialize(std::vector<size_t> is) override {
         if (is.size() < 2) {
             throw std::invalid_argument("Input shape must have at least two dimensions.");
@@ -18,12 +22,26 @@ public:
         output_shape = { input_shape[0], flattened_size};
     }
 
+    bool isView() const override {
+        return true;
+    }
+
+    // a view moves no data
+    Cost forwardCost() const override {
+        return { 0.0, 0.0 };
+    }
+
+    Cost backwardCost() const override {
+        return { 0.0, 0.0 };
+    }
+
+    // the output is the input under the flattened shape, nothing is copied
     void forward() override {
         if (!input) {
             throw std::runtime_error("Input tensor is not set for FlattenLayer.");
         }
 
-        output->data = input->data;
+        output->bind(input->data.data());
     }
 
     void backward(const Tensor& gradOutput) override {
@@ -31,6 +49,6 @@ public:
             throw std::invalid_argument("Gradient output size must match input size for FlattenLayer.");
         }
 
-        input_gradient->data = gradOutput.data; 
+        input_gradient->bind(const_cast<float*>(gradOutput.data.data()));
     }
-};
+};
\ No newline at end of file
@@ -0,0 +1,318 @@
+#pragma once
+
+#include "Parallel.hpp"
+#include "VectorMath.hpp"
+#include "Precision.hpp"
+#include <vector>
+#include <algorithm>
+#include <cmath>
+
+#if defined(__AVX512F__) || defined(__AVX2__)
+#include <immintrin.h>
+#endif
+
+// Cache blocked single precision GEMM on row-major matrices:
+//     C = alpha * op(A) * op(B) + beta * C
+// op(A) is M x K and op(B) is K x N. Blocks of op(A) and op(B) are packed into
+// contiguous MR / NR wide panels so the micro-kernel always reads memory linearly,
+// whatever the transposition of the operands. The micro-kernel is picked at compile
+// time: AVX-512 (6 x 32 tile), AVX2 + FMA (6 x 16 tile) or a portable scalar tile.
+// gemm also takes bfloat16 or float16 operands, widened to float while packing, so the
+// micro-kernel and the accumulation stay in single precision.
+class Gemm {
+public:
+	static const size_t MR = 6;
+#if defined(__AVX512F__)
+	static const size_t NR = 32;
+#elif defined(__AVX2__) && defined(__FMA__)
+	static const size_t NR = 16;
+#else
+	static const size_t NR = 16;
+#endif
+	static const size_t MC = 96;
+	static const size_t KC = 256;
+	static const size_t NC = 2048;
+
+	// Work applied to each output tile once its last K block is written, while it is still in cache
+	struct Epilogue {
+		enum ACTIVATIONS {
+			IDENTITY,
+			RELU,
+			SIGMOID
+		};
+
+		const float* bias;
+		bool bias_per_row; // bias[i] for row i, otherwise bias[j] for column j
+		ACTIVATIONS activation;
+
+		Epilogue() : bias(nullptr), bias_per_row(false), activation(IDENTITY) {}
+
+		bool empty() const { return !bias && activation == IDENTITY; }
+	};
+
+	static void sgemm(bool trans_a, bool trans_b,
+					  size_t M, size_t N, size_t K,
+					  float alpha, const float* A, size_t lda,
+					  const float* B, size_t ldb,
+					  float beta, float* C, size_t ldc,
+					  const Epilogue& epilogue = Epilogue())
+	{
+		gemm(trans_a, trans_b, M, N, K, alpha, A, lda, B, ldb, beta, C, ldc, epilogue);
+	}
+
+	// TA and TB are float, bfloat16 or float16, C is always float
+	template <typename TA, typename TB>
+	static void gemm(bool trans_a, bool trans_b,
+					 size_t M, size_t N, size_t K,
+					 float alpha, const TA* A, size_t lda,
+					 const TB* B, size_t ldb,
+					 float beta, float* C, size_t ldc,
+					 const Epilogue& epilogue = Epilogue())
+	{
+		if (!M || !N) return;
+
+		if (!K || alpha == 0.0f) {
+			scale(M, N, beta, C, ldc);
+			for (size_t i = 0; i < M && !epilogue.empty(); i++) {
+				applyEpilogue(epilogue, C + i * ldc, ldc, i, 0, 1, N);
+			}
+			return;
+		}
+
+		// called from a parallel region (e.g. one image per thread), run serially
+		const bool parallel = !Parallel::inParallel();
+
+		float* pa;
+		float* pb;
+		packingBuffers(pa, pb);
+
+		for (size_t jc = 0; jc < N; jc += NC) {
+			size_t nc = std::min(NC, N - jc);
+			size_t b_panels = (nc + NR - 1) / NR;
+
+			for (size_t pc = 0; pc < K; pc += KC) {
+				size_t kc = std::min(KC, K - pc);
+				float block_beta = pc == 0 ? beta : 1.0f;
+				bool last_block = pc + kc == K && !epilogue.empty();
+
+#pragma omp parallel for if(parallel)
+				for (size_t p = 0; p < b_panels; p++) {
+					packB(trans_b, B, ldb, pc, jc + p * NR, kc, std::min(NR, nc - p * NR), pb + p * NR * kc);
+				}
+
+				for (size_t ic = 0; ic < M; ic += MC) {
+					size_t mc = std::min(MC, M - ic);
+					size_t a_panels = (mc + MR - 1) / MR;
+
+					for (size_t p = 0; p < a_panels; p++) {
+						packA(trans_a, A, lda, ic + p * MR, pc, std::min(MR, mc - p * MR), kc, pa + p * MR * kc);
+					}
+
+#pragma omp parallel for collapse(2) if(parallel)
+					for (size_t jr = 0; jr < b_panels; jr++) {
+						for (size_t ir = 0; ir < a_panels; ir++) {
+							size_t row = ic + ir * MR, col = jc + jr * NR;
+							size_t mr = std::min(MR, mc - ir * MR), nr = std::min(NR, nc - jr * NR);
+							float* tile = C + row * ldc + col;
+
+							kernel(kc, pa + ir * MR * kc, pb + jr * NR * kc, tile, ldc, mr, nr, alpha, block_beta);
+							if (last_block) applyEpilogue(epilogue, tile, ldc, row, col, mr, nr);
+						}
+					}
+				}
+			}
+		}
+	}
+
+private:
+	// packing buffers are reused between calls, one set per calling thread shared by every
+	// operand type
+	static void packingBuffers(float*& pa, float*& pb) {
+		thread_local std::vector<float> packed_a(MC * KC), packed_b(NC * KC);
+		pa = packed_a.data();
+		pb = packed_b.data();
+	}
+
+	static void scale(size_t M, size_t N, float beta, float* C, size_t ldc) {
+		for (size_t i = 0; i < M; i++) {
+			for (size_t j = 0; j < N; j++) {
+				C[i * ldc + j] = beta == 0.0f ? 0.0f : beta * C[i * ldc + j];
+			}
+		}
+	}
+
+	static void applyEpilogue(const Epilogue& e, float* c, size_t ldc, size_t row, size_t col, size_t mr, size_t nr) {
+		for (size_t r = 0; r < mr; r++) {
+			float* out = c + r * ldc;
+
+			if (e.bias) {
+				if (e.bias_per_row) {
+					const float bias = e.bias[row + r];
+					for (size_t j = 0; j < nr; j++) out[j] += bias;
+				}
+				else {
+					for (size_t j = 0; j < nr; j++) out[j] += e.bias[col + j];
+				}
+			}
+
+			switch (e.activation) {
+			case (Epilogue::RELU):
+				for (size_t j = 0; j < nr; j++) out[j] = std::max(0.0f, out[j]);
+				break;
+			case (Epilogue::SIGMOID):
+				VectorMath::sigmoid(out, out, nr);
+				break;
+			default:
+				break;
+			}
+		}
+	}
+
+	// packs rows [row, row + mr) of op(A) as a kc x MR panel, zero padding missing rows
+	template <typename T>
+	static void packA(bool trans, const T* A, size_t lda, size_t row, size_t col, size_t mr, size_t kc, float* dst) {
+		for (size_t k = 0; k < kc; k++) {
+			for (size_t r = 0; r < MR; r++) {
+				float v = 0.0f;
+				if (r < mr) v = Precision::toFloat(trans ? A[(col + k) * lda + row + r] : A[(row + r) * lda + col + k]);
+				dst[k * MR + r] = v;
+			}
+		}
+	}
+
+	// packs columns [col, col + nr) of op(B) as a kc x NR panel, zero padding missing columns
+	template <typename T>
+	static void packB(bool trans, const T* B, size_t ldb, size_t row, size_t col, size_t kc, size_t nr, float* dst) {
+		for (size_t k = 0; k < kc; k++) {
+			for (size_t j = 0; j < NR; j++) {
+				float v = 0.0f;
+				if (j < nr) v = Precision::toFloat(trans ? B[(col + j) * ldb + row + k] : B[(row + k) * ldb + col + j]);
+				dst[k * NR + j] = v;
+			}
+		}
+	}
+
+#if defined(__AVX512F__)
+	static void kernel(size_t kc, const float* a, const float* b, float* c, size_t ldc,
+					   size_t mr, size_t nr, float alpha, float beta)
+	{
+		__m512 c00 = _mm512_setzero_ps(), c01 = _mm512_setzero_ps();
+		__m512 c10 = _mm512_setzero_ps(), c11 = _mm512_setzero_ps();
+		__m512 c20 = _mm512_setzero_ps(), c21 = _mm512_setzero_ps();
+		__m512 c30 = _mm512_setzero_ps(), c31 = _mm512_setzero_ps();
+		__m512 c40 = _mm512_setzero_ps(), c41 = _mm512_setzero_ps();
+		__m512 c50 = _mm512_setzero_ps(), c51 = _mm512_setzero_ps();
+
+		for (size_t k = 0; k < kc; k++, a += MR, b += NR) {
+			const __m512 b0 = _mm512_loadu_ps(b);
+			const __m512 b1 = _mm512_loadu_ps(b + 16);
+			__m512 av;
+
+			av = _mm512_set1_ps(a[0]); c00 = _mm512_fmadd_ps(av, b0, c00); c01 = _mm512_fmadd_ps(av, b1, c01);
+			av = _mm512_set1_ps(a[1]); c10 = _mm512_fmadd_ps(av, b0, c10); c11 = _mm512_fmadd_ps(av, b1, c11);
+			av = _mm512_set1_ps(a[2]); c20 = _mm512_fmadd_ps(av, b0, c20); c21 = _mm512_fmadd_ps(av, b1, c21);
+			av = _mm512_set1_ps(a[3]); c30 = _mm512_fmadd_ps(av, b0, c30); c31 = _mm512_fmadd_ps(av, b1, c31);
+			av = _mm512_set1_ps(a[4]); c40 = _mm512_fmadd_ps(av, b0, c40); c41 = _mm512_fmadd_ps(av, b1, c41);
+			av = _mm512_set1_ps(a[5]); c50 = _mm512_fmadd_ps(av, b0, c50); c51 = _mm512_fmadd_ps(av, b1, c51);
+		}
+
+		alignas(64) float acc[MR * NR];
+		_mm512_store_ps(acc + 0 * NR, c00); _mm512_store_ps(acc + 0 * NR + 16, c01);
+		_mm512_store_ps(acc + 1 * NR, c10); _mm512_store_ps(acc + 1 * NR + 16, c11);
+		_mm512_store_ps(acc + 2 * NR, c20); _mm512_store_ps(acc + 2 * NR + 16, c21);
+		_mm512_store_ps(acc + 3 * NR, c30); _mm512_store_ps(acc + 3 * NR + 16, c31);
+		_mm512_store_ps(acc + 4 * NR, c40); _mm512_store_ps(acc + 4 * NR + 16, c41);
+		_mm512_store_ps(acc + 5 * NR, c50); _mm512_store_ps(acc + 5 * NR + 16, c51);
+
+		if (mr == MR && nr == NR) {
+			const __m512 va = _mm512_set1_ps(alpha);
+			const __m512 vb = _mm512_set1_ps(beta);
+			for (size_t r = 0; r < MR; r++) {
+				for (size_t j = 0; j < NR; j += 16) {
+					__m512 v = _mm512_mul_ps(va, _mm512_load_ps(acc + r * NR + j));
+					if (beta != 0.0f) v = _mm512_fmadd_ps(vb, _mm512_loadu_ps(c + r * ldc + j), v);
+					_mm512_storeu_ps(c + r * ldc + j, v);
+				}
+			}
+			return;
+		}
+
+		store(acc, c, ldc, mr, nr, alpha, beta);
+	}
+#elif defined(__AVX2__) && defined(__FMA__)
+	static void kernel(size_t kc, const float* a, const float* b, float* c, size_t ldc,
+					   size_t mr, size_t nr, float alpha, float beta)
+	{
+		__m256 c00 = _mm256_setzero_ps(), c01 = _mm256_setzero_ps();
+		__m256 c10 = _mm256_setzero_ps(), c11 = _mm256_setzero_ps();
+		__m256 c20 = _mm256_setzero_ps(), c21 = _mm256_setzero_ps();
+		__m256 c30 = _mm256_setzero_ps(), c31 = _mm256_setzero_ps();
+		__m256 c40 = _mm256_setzero_ps(), c41 = _mm256_setzero_ps();
+		__m256 c50 = _mm256_setzero_ps(), c51 = _mm256_setzero_ps();
+
+		for (size_t k = 0; k < kc; k++, a += MR, b += NR) {
+			const __m256 b0 = _mm256_loadu_ps(b);
+			const __m256 b1 = _mm256_loadu_ps(b + 8);
+			__m256 av;
+
+			av = _mm256_broadcast_ss(a + 0); c00 = _mm256_fmadd_ps(av, b0, c00); c01 = _mm256_fmadd_ps(av, b1, c01);
+			av = _mm256_broadcast_ss(a + 1); c10 = _mm256_fmadd_ps(av, b0, c10); c11 = _mm256_fmadd_ps(av, b1, c11);
+			av = _mm256_broadcast_ss(a + 2); c20 = _mm256_fmadd_ps(av, b0, c20); c21 = _mm256_fmadd_ps(av, b1, c21);
+			av = _mm256_broadcast_ss(a + 3); c30 = _mm256_fmadd_ps(av, b0, c30); c31 = _mm256_fmadd_ps(av, b1, c31);
+			av = _mm256_broadcast_ss(a + 4); c40 = _mm256_fmadd_ps(av, b0, c40); c41 = _mm256_fmadd_ps(av, b1, c41);
+			av = _mm256_broadcast_ss(a + 5); c50 = _mm256_fmadd_ps(av, b0, c50); c51 = _mm256_fmadd_ps(av, b1, c51);
+		}
+
+		alignas(32) float acc[MR * NR];
+		_mm256_store_ps(acc + 0 * NR, c00); _mm256_store_ps(acc + 0 * NR + 8, c01);
+		_mm256_store_ps(acc + 1 * NR, c10); _mm256_store_ps(acc + 1 * NR + 8, c11);
+		_mm256_store_ps(acc + 2 * NR, c20); _mm256_store_ps(acc + 2 * NR + 8, c21);
+		_mm256_store_ps(acc + 3 * NR, c30); _mm256_store_ps(acc + 3 * NR + 8, c31);
+		_mm256_store_ps(acc + 4 * NR, c40); _mm256_store_ps(acc + 4 * NR + 8, c41);
+		_mm256_store_ps(acc + 5 * NR, c50); _mm256_store_ps(acc + 5 * NR + 8, c51);
+
+		if (mr == MR && nr == NR) {
+			const __m256 va = _mm256_set1_ps(alpha);
+			const __m256 vb = _mm256_set1_ps(beta);
+			for (size_t r = 0; r < MR; r++) {
+				for (size_t j = 0; j < NR; j += 8) {
+					__m256 v = _mm256_mul_ps(va, _mm256_load_ps(acc + r * NR + j));
+					if (beta != 0.0f) v = _mm256_fmadd_ps(vb, _mm256_loadu_ps(c + r * ldc + j), v);
+					_mm256_storeu_ps(c + r * ldc + j, v);
+				}
+			}
+			return;
+		}
+
+		store(acc, c, ldc, mr, nr, alpha, beta);
+	}
+#else
+	// MR x NR register tile, written so the compiler can keep acc in vector registers
+	static void kernel(size_t kc, const float* a, const float* b, float* c, size_t ldc,
+					   size_t mr, size_t nr, float alpha, float beta)
+	{
+		float acc[MR * NR] = {};
+
+		for (size_t k = 0; k < kc; k++) {
+			for (size_t r = 0; r < MR; r++) {
+				const float av = a[k * MR + r];
+				for (size_t j = 0; j < NR; j++) {
+					acc[r * NR + j] += av * b[k * NR + j];
+				}
+			}
+		}
+
+		store(acc, c, ldc, mr, nr, alpha, beta);
+	}
+#endif
+
+	// writes the valid mr x nr corner of an accumulator tile to C
+	static void store(const float* acc, float* c, size_t ldc, size_t mr, size_t nr, float alpha, float beta) {
+		for (size_t r = 0; r < mr; r++) {
+			for (size_t j = 0; j < nr; j++) {
+				float& out = c[r * ldc + j];
+				out = alpha * acc[r * NR + j] + (beta == 0.0f ? 0.0f : beta * out);
+			}
+		}
+	}
+};
\ No newline at end of file
@@ -0,0 +1,75 @@
+#pragma once
+
+#include "Tensor.hpp"
+#include "Precision.hpp"
+
+// A tensor stored in 16 bits, BFLOAT16 or FLOAT16, at half the memory of a Tensor. It is storage
+// only: kernels read it through the bfloat16 / float16 pointers and convert as they load, and
+// toTensor expands it back to float.
+class HalfTensor {
+private:
+	std::vector<size_t> shape;
+	Precision::TYPES type = Precision::BFLOAT16;
+
+	// only the vector of the current type is filled
+	std::vector<bfloat16> bf16;
+	std::vector<float16> fp16;
+
+public:
+	HalfTensor() = default;
+
+	HalfTensor(const Tensor& tensor, Precision::TYPES _type) {
+		assign(tensor, _type);
+	}
+
+	// Converts tensor into this storage, reusing its memory when the size does not change
+	void assign(const Tensor& tensor, Precision::TYPES _type) {
+		if (_type == Precision::FLOAT32) {
+			throw std::invalid_argument("A HalfTensor stores BFLOAT16 or FLOAT16.");
+		}
+
+		shape = tensor.getShape();
+		type = _type;
+		const size_t n = tensor.data.size();
+
+		if (type == Precision::BFLOAT16) {
+			fp16 = std::vector<float16>();
+			bf16.resize(n);
+			Precision::convert(tensor.data.data(), bf16.data(), n);
+		}
+		else {
+			bf16 = std::vector<bfloat16>();
+			fp16.resize(n);
+			Precision::convert(tensor.data.data(), fp16.data(), n);
+		}
+	}
+
+	Tensor toTensor() const {
+		Tensor result = Tensor::uninitialized(shape);
+		if (type == Precision::BFLOAT16) Precision::convert(bf16.data(), result.data.data(), size());
+		else Precision::convert(fp16.data(), result.data.data(), size());
+		return result;
+	}
+
+	void clear() {
+		shape.clear();
+		bf16 = std::vector<bfloat16>();
+		fp16 = std::vector<float16>();
+	}
+
+	// Calls f with a pointer to the elements in their own type, const bfloat16* or const float16*
+	template <typename F>
+	void visit(F f) const {
+		if (type == Precision::BFLOAT16) f(bf16.data());
+		else f(fp16.data());
+	}
+
+	const bfloat16* bfloat16Data() const { return bf16.data(); }
+	const float16* float16Data() const { return fp16.data(); }
+
+	Precision::TYPES getType() const { return type; }
+	const std::vector<size_t>& getShape() const { return shape; }
+	size_t size() const { return type == Precision::BFLOAT16 ? bf16.size() : fp16.size(); }
+	bool empty() const { return size() == 0; }
+	size_t bytes() const { return size() * Precision::bytes(type); }
+};
\ No newline at end of file
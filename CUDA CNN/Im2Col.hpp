@@ -0,0 +1,140 @@
+#pragma once
+
+#include <cstring>
+#include <algorithm>
+
+// Shape of a single image convolution, shared by the im2col based kernels
+struct ConvGeometry {
+	size_t channels;
+	size_t height;
+	size_t width;
+	size_t kernel_h;
+	size_t kernel_w;
+	size_t stride;
+	size_t padding;
+	size_t out_h;
+	size_t out_w;
+
+	size_t colRows() const { return channels * kernel_h * kernel_w; }
+	size_t colCols() const { return out_h * out_w; }
+
+	// a 1x1, stride 1, unpadded convolution is already in column form
+	bool isPointwise() const { return kernel_h == 1 && kernel_w == 1 && stride == 1 && padding == 0; }
+};
+
+class Im2Col {
+public:
+	// Lowers one CHW image into a (C * kh * kw) x (out_h * out_w) column matrix,
+	// rows ordered (c, kh, kw) to match the weight layout of ConvLayer.
+	static void im2col(const float* image, const ConvGeometry& g, float* col) {
+		const size_t cols = g.colCols();
+
+		for (size_t c = 0; c < g.channels; c++) {
+			const float* plane = image + c * g.height * g.width;
+
+			for (size_t kh = 0; kh < g.kernel_h; kh++) {
+				for (size_t kw = 0; kw < g.kernel_w; kw++) {
+					float* row = col + ((c * g.kernel_h + kh) * g.kernel_w + kw) * cols;
+
+					size_t ow_begin, ow_end;
+					validRange(kw, g.width, g.out_w, g, ow_begin, ow_end);
+
+					for (size_t oh = 0; oh < g.out_h; oh++) {
+						float* dst = row + oh * g.out_w;
+						long long ih = static_cast<long long>(oh * g.stride + kh) - static_cast<long long>(g.padding);
+
+						if (ih < 0 || ih >= static_cast<long long>(g.height) || ow_begin >= ow_end) {
+							std::fill(dst, dst + g.out_w, 0.0f);
+							continue;
+						}
+
+						const float* src = plane + ih * g.width;
+						std::fill(dst, dst + ow_begin, 0.0f);
+
+						if (g.stride == 1) {
+							std::memcpy(dst + ow_begin, src + ow_begin + kw - g.padding, (ow_end - ow_begin) * sizeof(float));
+						}
+						else {
+							for (size_t ow = ow_begin; ow < ow_end; ow++) {
+								dst[ow] = src[ow * g.stride + kw - g.padding];
+							}
+						}
+
+						std::fill(dst + ow_end, dst + g.out_w, 0.0f);
+					}
+				}
+			}
+		}
+	}
+
+	// Scatters a column matrix back onto a CHW image, accumulating overlapping windows.
+	// The image must be zeroed by the caller.
+	static void col2im(const float* col, const ConvGeometry& g, float* image) {
+		const size_t cols = g.colCols();
+
+		for (size_t c = 0; c < g.channels; c++) {
+			float* plane = image + c * g.height * g.width;
+
+			for (size_t kh = 0; kh < g.kernel_h; kh++) {
+				for (size_t kw = 0; kw < g.kernel_w; kw++) {
+					const float* row = col + ((c * g.kernel_h + kh) * g.kernel_w + kw) * cols;
+
+					size_t ow_begin, ow_end;
+					validRange(kw, g.width, g.out_w, g, ow_begin, ow_end);
+
+					for (size_t oh = 0; oh < g.out_h; oh++) {
+						long long ih = static_cast<long long>(oh * g.stride + kh) - static_cast<long long>(g.padding);
+						if (ih < 0 || ih >= static_cast<long long>(g.height)) continue;
+
+						const float* src = row + oh * g.out_w;
+						float* dst = plane + ih * g.width;
+
+						for (size_t ow = ow_begin; ow < ow_end; ow++) {
+							dst[ow * g.stride + kw - g.padding] += src[ow];
+						}
+					}
+				}
+			}
+		}
+	}
+
+	// Transposed lowering: row (oh * out_w + ow) holds the C * kh * kw window of that output
+	// position, ordered like im2col rows. Rows are ld apart and zero padded past colRows().
+	template <typename T>
+	static void im2row(const T* image, const ConvGeometry& g, T* rows, size_t ld) {
+		const size_t depth = g.colRows();
+
+		for (size_t oh = 0; oh < g.out_h; oh++) {
+			for (size_t ow = 0; ow < g.out_w; ow++) {
+				T* dst = rows + (oh * g.out_w + ow) * ld;
+
+				for (size_t c = 0; c < g.channels; c++) {
+					const T* plane = image + c * g.height * g.width;
+
+					for (size_t kh = 0; kh < g.kernel_h; kh++) {
+						long long ih = static_cast<long long>(oh * g.stride + kh) - static_cast<long long>(g.padding);
+						bool row_inside = ih >= 0 && ih < static_cast<long long>(g.height);
+
+						for (size_t kw = 0; kw < g.kernel_w; kw++) {
+							long long iw = static_cast<long long>(ow * g.stride + kw) - static_cast<long long>(g.padding);
+							bool inside = row_inside && iw >= 0 && iw < static_cast<long long>(g.width);
+							*dst++ = inside ? plane[ih * g.width + iw] : T(0);
+						}
+					}
+				}
+
+				std::fill(dst, dst + (ld - depth), T(0));
+			}
+		}
+	}
+
+private:
+	// output columns [begin, end) whose input column ow * stride + k - padding lies inside the image
+	static void validRange(size_t k, size_t size, size_t out, const ConvGeometry& g, size_t& begin, size_t& end) {
+		begin = 0;
+		while (begin < out && begin * g.stride + k < g.padding) begin++;
+
+		end = begin;
+		while (end < out && end * g.stride + k - g.padding < size) end++;
+	}
+};
\ No newline at end of file
@@ -0,0 +1,253 @@
+#pragma once
+
+#include "Gemm.hpp"
+#include "Parallel.hpp"
+#include <cstdint>
+#include <vector>
+#include <cmath>
+#include <algorithm>
+
+#if defined(__AVX512VNNI__) || defined(__AVX2__)
+#include <immintrin.h>
+#endif
+
+// int8 x int8 -> int32 GEMM for quantized inference:
+//     C[i, j] = x_scale * w_scale[j] * sum_k X[i, k] * W[j, k]   (+ bias[j], activation)
+// Activations X have one scale per tensor, weights W one scale per output channel j. Both are
+// stored row-major with K contiguous and zero padded to a multiple of K_ALIGN, so each output is
+// the dot product of two contiguous rows, computed for an MR x NR tile of outputs at a time.
+// With AVX512-VNNI the products use vpdpbusd, which takes unsigned activations: X is offset by
+// 128 on the fly and 128 * sum_k W[j, k] subtracted at the end. AVX2 sign extends both sides to
+// 16 bit for vpmaddwd instead of using vpmaddubsw, whose 16 bit sums can saturate.
+class Int8Gemm {
+public:
+	static const size_t K_ALIGN = 64;
+#if defined(__AVX512VNNI__)
+	static const size_t MR = 4;
+	static const int32_t X_OFFSET = 128;
+#elif defined(__AVX2__)
+	static const size_t MR = 2;
+	static const int32_t X_OFFSET = 0;
+#else
+	static const size_t MR = 4;
+	static const int32_t X_OFFSET = 0;
+#endif
+	static const size_t NR = 4;
+
+	struct Weights {
+		std::vector<int8_t> values; // channels x padded_depth
+		std::vector<float> scales;  // one per channel
+		std::vector<int32_t> sums;  // sum of each channel's values
+		size_t channels = 0;
+		size_t depth = 0;
+		size_t padded_depth = 0;
+
+		bool empty() const { return values.empty(); }
+	};
+
+	static size_t paddedDepth(size_t depth) {
+		return (depth + K_ALIGN - 1) / K_ALIGN * K_ALIGN;
+	}
+
+	// Symmetric per channel quantization, element k of channel j is w[j * channel_stride + k * depth_stride]
+	static Weights quantizeWeights(const float* w, size_t channels, size_t depth, size_t channel_stride, size_t depth_stride) {
+		Weights q;
+		q.channels = channels;
+		q.depth = depth;
+		q.padded_depth = paddedDepth(depth);
+		q.values.assign(channels * q.padded_depth, 0);
+		q.scales.resize(channels);
+		q.sums.resize(channels);
+
+#pragma omp parallel for
+		for (size_t j = 0; j < channels; j++) {
+			float range = 0.0f;
+			for (size_t k = 0; k < depth; k++) {
+				range = std::max(range, std::fabs(w[j * channel_stride + k * depth_stride]));
+			}
+
+			const float scale = range > 0.0f ? range / 127.0f : 1.0f;
+			int32_t sum = 0;
+
+			for (size_t k = 0; k < depth; k++) {
+				int8_t v = toInt8(w[j * channel_stride + k * depth_stride] / scale);
+				q.values[j * q.padded_depth + k] = v;
+				sum += v;
+			}
+
+			q.scales[j] = scale;
+			q.sums[j] = sum;
+		}
+
+		return q;
+	}
+
+	// q[i] = round(x[i] / scale), clamped to [-127, 127]
+	static void quantize(const float* x, size_t n, float scale, int8_t* q) {
+		const float inverse = 1.0f / scale;
+		for (size_t i = 0; i < n; i++) {
+			q[i] = toInt8(x[i] * inverse);
+		}
+	}
+
+	// quantizes rows x n values with row strides ldx and ldq, zeroing the padding [n, ldq) of every row
+	static void quantizeRows(const float* x, size_t rows, size_t n, size_t ldx, float scale, int8_t* q, size_t ldq) {
+#pragma omp parallel for if(!Parallel::inParallel())
+		for (size_t r = 0; r < rows; r++) {
+			quantize(x + r * ldx, n, scale, q + r * ldq);
+			std::fill(q + r * ldq + n, q + (r + 1) * ldq, int8_t(0));
+		}
+	}
+
+	// C[i * row_stride + j * col_stride] for the M x W.channels outputs, X is M x W.padded_depth.
+	// The epilogue bias is indexed by output channel j.
+	static void gemm(size_t M, const int8_t* X, float x_scale, const Weights& W,
+					 float* C, size_t row_stride, size_t col_stride,
+					 const Gemm::Epilogue& epilogue = Gemm::Epilogue())
+	{
+		const size_t N = W.channels;
+		const size_t K = W.padded_depth;
+		const size_t row_blocks = (M + MR - 1) / MR;
+		const size_t col_blocks = (N + NR - 1) / NR;
+
+		// called from a parallel region (e.g. one image per thread), run serially
+		const bool parallel = !Parallel::inParallel();
+
+#pragma omp parallel for collapse(2) if(parallel)
+		for (size_t ib = 0; ib < row_blocks; ib++) {
+			for (size_t jb = 0; jb < col_blocks; jb++) {
+				const size_t i = ib * MR, j = jb * NR;
+				const size_t mr = std::min(MR, M - i), nr = std::min(NR, N - j);
+
+				int32_t acc[MR * NR];
+				kernel(X + i * K, W.values.data() + j * K, K, mr, nr, acc);
+				store(acc, W, x_scale, i, j, mr, nr, C, row_stride, col_stride, epilogue);
+			}
+		}
+	}
+
+private:
+	static int8_t toInt8(float v) {
+		v = std::min(127.0f, std::max(-127.0f, v));
+		return static_cast<int8_t>(v + (v >= 0.0f ? 0.5f : -0.5f));
+	}
+
+	// rows past mr / nr repeat the last valid row, their results are discarded by store
+	static void rows(const int8_t* base, size_t K, size_t count, size_t n, const int8_t** out) {
+		for (size_t r = 0; r < count; r++) out[r] = base + std::min(r, n - 1) * K;
+	}
+
+#if defined(__AVX512VNNI__) || defined(__AVX2__)
+	static int32_t sum(__m256i v) {
+		__m128i s = _mm_add_epi32(_mm256_castsi256_si128(v), _mm256_extracti128_si256(v, 1));
+		s = _mm_add_epi32(s, _mm_shuffle_epi32(s, _MM_SHUFFLE(1, 0, 3, 2)));
+		s = _mm_add_epi32(s, _mm_shuffle_epi32(s, _MM_SHUFFLE(2, 3, 0, 1)));
+		return _mm_cvtsi128_si32(s);
+	}
+#endif
+
+#if defined(__AVX512VNNI__)
+	static int32_t sum(__m512i v) {
+		return sum(_mm256_add_epi32(_mm512_maskz_extracti64x4_epi64(0xFF, v, 0), _mm512_maskz_extracti64x4_epi64(0xFF, v, 1)));
+	}
+
+	static void kernel(const int8_t* x, const int8_t* w, size_t K, size_t mr, size_t nr, int32_t* acc) {
+		const int8_t* xr[MR];
+		const int8_t* wr[NR];
+		rows(x, K, MR, mr, xr);
+		rows(w, K, NR, nr, wr);
+
+		__m512i c00 = _mm512_setzero_si512(), c01 = _mm512_setzero_si512(), c02 = _mm512_setzero_si512(), c03 = _mm512_setzero_si512();
+		__m512i c10 = _mm512_setzero_si512(), c11 = _mm512_setzero_si512(), c12 = _mm512_setzero_si512(), c13 = _mm512_setzero_si512();
+		__m512i c20 = _mm512_setzero_si512(), c21 = _mm512_setzero_si512(), c22 = _mm512_setzero_si512(), c23 = _mm512_setzero_si512();
+		__m512i c30 = _mm512_setzero_si512(), c31 = _mm512_setzero_si512(), c32 = _mm512_setzero_si512(), c33 = _mm512_setzero_si512();
+
+		// flipping the sign bit maps int8 x to the uint8 x + 128
+		const __m512i offset = _mm512_set1_epi8(-128);
+
+		for (size_t k = 0; k < K; k += 64) {
+			const __m512i b0 = _mm512_loadu_si512(wr[0] + k);
+			const __m512i b1 = _mm512_loadu_si512(wr[1] + k);
+			const __m512i b2 = _mm512_loadu_si512(wr[2] + k);
+			const __m512i b3 = _mm512_loadu_si512(wr[3] + k);
+			__m512i a;
+
+			a = _mm512_xor_si512(_mm512_loadu_si512(xr[0] + k), offset);
+			c00 = _mm512_dpbusd_epi32(c00, a, b0); c01 = _mm512_dpbusd_epi32(c01, a, b1); c02 = _mm512_dpbusd_epi32(c02, a, b2); c03 = _mm512_dpbusd_epi32(c03, a, b3);
+			a = _mm512_xor_si512(_mm512_loadu_si512(xr[1] + k), offset);
+			c10 = _mm512_dpbusd_epi32(c10, a, b0); c11 = _mm512_dpbusd_epi32(c11, a, b1); c12 = _mm512_dpbusd_epi32(c12, a, b2); c13 = _mm512_dpbusd_epi32(c13, a, b3);
+			a = _mm512_xor_si512(_mm512_loadu_si512(xr[2] + k), offset);
+			c20 = _mm512_dpbusd_epi32(c20, a, b0); c21 = _mm512_dpbusd_epi32(c21, a, b1); c22 = _mm512_dpbusd_epi32(c22, a, b2); c23 = _mm512_dpbusd_epi32(c23, a, b3);
+			a = _mm512_xor_si512(_mm512_loadu_si512(xr[3] + k), offset);
+			c30 = _mm512_dpbusd_epi32(c30, a, b0); c31 = _mm512_dpbusd_epi32(c31, a, b1); c32 = _mm512_dpbusd_epi32(c32, a, b2); c33 = _mm512_dpbusd_epi32(c33, a, b3);
+		}
+
+		acc[0] = sum(c00); acc[1] = sum(c01); acc[2] = sum(c02); acc[3] = sum(c03);
+		acc[4] = sum(c10); acc[5] = sum(c11); acc[6] = sum(c12); acc[7] = sum(c13);
+		acc[8] = sum(c20); acc[9] = sum(c21); acc[10] = sum(c22); acc[11] = sum(c23);
+		acc[12] = sum(c30); acc[13] = sum(c31); acc[14] = sum(c32); acc[15] = sum(c33);
+	}
+#elif defined(__AVX2__)
+	static __m256i load16(const int8_t* p) {
+		return _mm256_cvtepi8_epi16(_mm_loadu_si128(reinterpret_cast<const __m128i*>(p)));
+	}
+
+	static void kernel(const int8_t* x, const int8_t* w, size_t K, size_t mr, size_t nr, int32_t* acc) {
+		const int8_t* xr[MR];
+		const int8_t* wr[NR];
+		rows(x, K, MR, mr, xr);
+		rows(w, K, NR, nr, wr);
+
+		__m256i c00 = _mm256_setzero_si256(), c01 = _mm256_setzero_si256(), c02 = _mm256_setzero_si256(), c03 = _mm256_setzero_si256();
+		__m256i c10 = _mm256_setzero_si256(), c11 = _mm256_setzero_si256(), c12 = _mm256_setzero_si256(), c13 = _mm256_setzero_si256();
+
+		for (size_t k = 0; k < K; k += 16) {
+			const __m256i b0 = load16(wr[0] + k);
+			const __m256i b1 = load16(wr[1] + k);
+			const __m256i b2 = load16(wr[2] + k);
+			const __m256i b3 = load16(wr[3] + k);
+			__m256i a;
+
+			a = load16(xr[0] + k);
+			c00 = _mm256_add_epi32(c00, _mm256_madd_epi16(a, b0)); c01 = _mm256_add_epi32(c01, _mm256_madd_epi16(a, b1));
+			c02 = _mm256_add_epi32(c02, _mm256_madd_epi16(a, b2)); c03 = _mm256_add_epi32(c03, _mm256_madd_epi16(a, b3));
+			a = load16(xr[1] + k);
+			c10 = _mm256_add_epi32(c10, _mm256_madd_epi16(a, b0)); c11 = _mm256_add_epi32(c11, _mm256_madd_epi16(a, b1));
+			c12 = _mm256_add_epi32(c12, _mm256_madd_epi16(a, b2)); c13 = _mm256_add_epi32(c13, _mm256_madd_epi16(a, b3));
+		}
+
+		acc[0] = sum(c00); acc[1] = sum(c01); acc[2] = sum(c02); acc[3] = sum(c03);
+		acc[4] = sum(c10); acc[5] = sum(c11); acc[6] = sum(c12); acc[7] = sum(c13);
+	}
+#else
+	static void kernel(const int8_t* x, const int8_t* w, size_t K, size_t mr, size_t nr, int32_t* acc) {
+		for (size_t r = 0; r < MR; r++) {
+			for (size_t j = 0; j < NR; j++) {
+				int32_t s = 0;
+				if (r < mr && j < nr) {
+					for (size_t k = 0; k < K; k++) s += int32_t(x[r * K + k]) * int32_t(w[j * K + k]);
+				}
+				acc[r * NR + j] = s;
+			}
+		}
+	}
+#endif
+
+	// dequantizes the valid mr x nr corner of a tile and applies bias and activation
+	static void store(const int32_t* acc, const Weights& W, float x_scale, size_t i, size_t j, size_t mr, size_t nr,
+					  float* C, size_t row_stride, size_t col_stride, const Gemm::Epilogue& e)
+	{
+		for (size_t r = 0; r < mr; r++) {
+			for (size_t c = 0; c < nr; c++) {
+				const size_t channel = j + c;
+				float v = x_scale * W.scales[channel] * static_cast<float>(acc[r * NR + c] - X_OFFSET * W.sums[channel]);
+
+				if (e.bias) v += e.bias[channel];
+				if (e.activation == Gemm::Epilogue::RELU) v = std::max(0.0f, v);
+				else if (e.activation == Gemm::Epilogue::SIGMOID) v = VectorMath::sigmoid(v);
+
+				C[(i + r) * row_stride + channel * col_stride] = v;
+			}
+		}
+	}
+};
\ No newline at end of file
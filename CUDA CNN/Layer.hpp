@@ -1,6 +1,8 @@
 #pragma once
 
 #include "Tensor.hpp"
+#include "Int8Gemm.hpp"
+#include "HalfTensor.hpp"
 #include "ActivationFunctions.hpp"
 #include "Initializer.hpp"
 
@@ -15,6 +17,126 @@ protected:
 	std::vector<size_t> input_shape;
 	std::vector<size_t> output_shape;
 
+	// storage behind output, input_gradient and the parameter gradients, owned by the layer
+	// but normally bound to the network's activation and parameter arenas
+	Tensor output_buffer;
+	Tensor input_gradient_buffer;
+	Tensor weight_gradient_buffer;
+	Tensor bias_gradient_buffer;
+
+	// dY masked by the derivative of a fused activation
+	Tensor activation_gradient;
+
+	// weights and biases came from setParameters, initialize keeps them
+	bool parameters_loaded = false;
+
+	// forward only, set by Network::compileForInference: no gradient state is allocated
+	bool inference = false;
+
+	// memory order of the input and output, set by Network::compileForInference
+	Layout::TYPES layout = Layout::NCHW;
+
+	// int8 weights and the calibrated input scale, set by quantize on layers that support it
+	Int8Gemm::Weights quantized_weights;
+	float input_scale = 1.0f;
+
+	// storage precision of the weights the kernels read, set by Network::setPrecision on layers
+	// that support it. Below FLOAT32 they read half_weights, a 16 bit copy of weights, which
+	// stay the fp32 master copy the optimizer updates.
+	Precision::TYPES precision = Precision::FLOAT32;
+	HalfTensor half_weights;
+
+	static double elements(const std::vector<size_t>& shape) {
+		return std::accumulate(shape.begin(), shape.end(), 1.0, std::multiplies<>());
+	}
+
+	// bytes of weights read by the kernels, in their storage precision
+	double weightBytes() const {
+		return double(weights.data.size()) * Precision::bytes(precision);
+	}
+
+	// allocates gradients matching weights and biases, for layers with parameters
+	void initGradients() {
+		if (inference) {
+			weight_gradient_buffer = Tensor();
+			bias_gradient_buffer = Tensor();
+			weight_gradient = nullptr;
+			bias_gradient = nullptr;
+			return;
+		}
+
+		weight_gradient_buffer = Tensor(weights.getShape());
+		bias_gradient_buffer = Tensor(biases.getShape());
+		weight_gradient = &weight_gradient_buffer;
+		bias_gradient = &bias_gradient_buffer;
+	}
+
+	// true when setParameters supplied weights and biases, which must then match the given shapes
+	bool useLoadedParameters(const std::vector<size_t>& weight_shape, const std::vector<size_t>& bias_shape) const {
+		if (!parameters_loaded) return false;
+
+		if (weights.getShape() != weight_shape || biases.getShape() != bias_shape) {
+			throw std::invalid_argument("Loaded parameters do not match the layer shape.");
+		}
+
+		return true;
+	}
+
+	bool hasFusableActivation() const {
+		return activation_function == ActivationFunctions::TYPES::RELU ||
+			activation_function == ActivationFunctions::TYPES::SIGMOID;
+	}
+
+	// bias + activation applied by the GEMM as each output tile is finished
+	Gemm::Epilogue epilogue(const float* bias, bool bias_per_row) const {
+		Gemm::Epilogue e;
+		e.bias = bias;
+		e.bias_per_row = bias_per_row;
+
+		if (fusesActivation()) {
+			e.activation = activation_function == ActivationFunctions::TYPES::RELU ?
+				Gemm::Epilogue::RELU : Gemm::Epilogue::SIGMOID;
+		}
+
+		return e;
+	}
+
+	// calls f with the weights the kernels should read: const float*, or const bfloat16* or
+	// const float16* when the layer runs in reduced precision
+	template <typename F>
+	void withWeights(F f) const {
+		if (half_weights.empty()) f(weights.data.data());
+		else half_weights.visit(f);
+	}
+
+	float activate(float a) const {
+		if (!fusesActivation()) return a;
+		if (activation_function == ActivationFunctions::TYPES::RELU) return std::max(0.0f, a);
+		return 1.0f / (1.0f + std::exp(-a));
+	}
+
+	// Gradient with respect to the pre-activation output, computed from the saved
+	// output so the fused backward does not need the pre-activation values.
+	const Tensor& preActivationGradient(const Tensor& gradOutput) {
+		if (!fusesActivation()) return gradOutput;
+
+		if (activation_gradient.getShape() != gradOutput.getShape()) {
+			activation_gradient = Tensor::uninitialized(gradOutput.getShape());
+		}
+
+		const bool relu = activation_function == ActivationFunctions::TYPES::RELU;
+
+#pragma omp parallel for
+		for (size_t i = 0; i < gradOutput.data.size(); i++) {
+			const float y = output->data[i];
+			activation_gradient.data[i] = relu ?
+				(y > 0.0f ? gradOutput.data[i] : 0.0f) :
+				gradOutput.data[i] * y * (1.0f - y);
+		}
+
+		return activation_gradient;
+	}
+
 public: 
 	Tensor biases;
 	Tensor weights;
@@ -22,6 +144,103 @@ public:
 	Layer(ActivationFunctions::TYPES _ac = ActivationFunctions::TYPES::NONE) : activation_function(_ac) {};
 	virtual ~Layer() {}
 
+	// Type tag and constructor arguments, enough for ModelFile to rebuild the layer
+	virtual const char* getType() const = 0;
+
+	virtual std::vector<double> getHyperparameters() const {
+		return {};
+	}
+
+	// Uses the given tensors, typically bound to a mapped model file, as weights and biases
+	// instead of initializing new ones
+	void setParameters(Tensor _weights, Tensor _biases) {
+		// drop any binding first, so the new storage is taken instead of written through
+		weights = Tensor();
+		biases = Tensor();
+
+		weights = std::move(_weights);
+		biases = std::move(_biases);
+		parameters_loaded = true;
+	}
+
+	// Analytical cost of one forward or backward call at the current batch size, for the
+	// network's profiler. The default counts no arithmetic, only reading the input (or output
+	// gradient) and writing the output (or input gradient).
+	struct Cost {
+		double flops;
+		double bytes;
+	};
+
+	virtual Cost forwardCost() const {
+		return { 0.0, (elements(input_shape) + elements(output_shape)) * sizeof(float) };
+	}
+
+	virtual Cost backwardCost() const {
+		return { 0.0, (elements(output_shape) + elements(input_shape)) * sizeof(float) };
+	}
+
+	// Layouts the layer can run in natively, besides NCHW
+	virtual bool supportsLayout(Layout::TYPES _layout) const {
+		return _layout == Layout::NCHW;
+	}
+
+	virtual void setLayout(Layout::TYPES _layout) {
+		layout = _layout;
+	}
+
+	virtual Layout::TYPES getInputLayout() const {
+		return layout;
+	}
+
+	virtual Layout::TYPES getOutputLayout() const {
+		return layout;
+	}
+
+	void setInference(bool _inference) {
+		inference = _inference;
+	}
+
+	bool isInference() const {
+		return inference;
+	}
+
+	// Post-training INT8 quantization, see Network::quantize. input_range is the largest
+	// absolute input seen while calibrating.
+	virtual bool supportsQuantization() const {
+		return false;
+	}
+
+	virtual void quantize(float input_range) {}
+
+	void dequantize() {
+		quantized_weights = Int8Gemm::Weights();
+	}
+
+	bool isQuantized() const {
+		return !quantized_weights.empty();
+	}
+
+	// Reduced precision weight storage, see Network::setPrecision. Layers without support
+	// stay in FLOAT32.
+	virtual bool supportsHalfPrecision() const {
+		return false;
+	}
+
+	void setPrecision(Precision::TYPES _precision) {
+		precision = supportsHalfPrecision() ? _precision : Precision::FLOAT32;
+		refreshHalfWeights();
+	}
+
+	Precision::TYPES getPrecision() const {
+		return precision;
+	}
+
+	// converts the current weights into half_weights, after every change of the fp32 weights
+	void refreshHalfWeights() {
+		if (precision == Precision::FLOAT32 || weights.data.empty()) half_weights.clear();
+		else half_weights.assign(weights, precision);
+	}
+
 	void setInput(Tensor* _input) {
 		input = _input;
 	}
@@ -34,6 +253,14 @@ public:
 		return activation_function;
 	}
 
+	// true when the layer applies its activation itself (bias + activation epilogue)
+	virtual bool fusesActivation() const {
+		return false;
+	}
+
+	// Called by Network::compile with the layer feeding this one (nullptr for the first layer)
+	virtual void fuseActivation(const Layer* previous) {}
+
 	Tensor* getInput() const {
 		return input;
 	}
@@ -58,17 +285,54 @@ public:
 		return bias_gradient;
 	}
 
+	// Sets the number of batches; memory is attached afterwards with bindBuffers
 	virtual void initOutput(size_t batches) {
 		if (!output_shape.size()) {
-			throw std::exception("Layer must be intialized prior to setting the number of batches");
+			throw std::runtime_error("Layer must be intialized prior to setting the number of batches");
 		}
 
 		input_shape[0] = batches;
 		output_shape[0] = batches;
-		output = new Tensor(output_shape);
-
-		input_gradient = new Tensor(input_shape);
 	};
+
+	// Points output and input_gradient at memory planned by the network, a nullptr
+	// allocates that buffer inside the layer instead. Inference layers have no input_gradient.
+	void bindBuffers(float* output_memory, float* gradient_memory) {
+		output_buffer = output_memory ? Tensor::bind(output_shape, output_memory, getOutputLayout()) : Tensor(output_shape, getOutputLayout());
+		output = &output_buffer;
+
+		if (inference) {
+			input_gradient_buffer = Tensor();
+			input_gradient = nullptr;
+			return;
+		}
+
+		input_gradient_buffer = gradient_memory ? Tensor::bind(input_shape, gradient_memory, getInputLayout()) : Tensor(input_shape, getInputLayout());
+		input_gradient = &input_gradient_buffer;
+	}
+
+	// True for layers that only reinterpret the shape of their input. Their output is a view of
+	// the input and their input gradient a view of the output gradient, rebound on every pass,
+	// so the network plans no memory for them.
+	virtual bool isView() const {
+		return false;
+	}
+
+	// Creates the output and input gradient of a view layer, unbound until the first pass
+	void bindView() {
+		output_buffer = Tensor::bind(output_shape, nullptr, getOutputLayout());
+		output = &output_buffer;
+
+		if (inference) {
+			input_gradient_buffer = Tensor();
+			input_gradient = nullptr;
+			return;
+		}
+
+		input_gradient_buffer = Tensor::bind(input_shape, nullptr, getInputLayout());
+		input_gradient = &input_gradient_buffer;
+	}
+
 	virtual void initialize(std::vector<size_t> input_shape) = 0;
 	virtual void forward() = 0;
 	virtual void backward(const Tensor& gradOutput) = 0;
@@ -0,0 +1,147 @@
+#pragma once
+
+#include <vector>
+#include <numeric>
+#include <functional>
+#include <algorithm>
+#include <cstring>
+
+// Memory order of 4-d activations. The shape of a tensor is always the logical { N, C, H, W },
+// the layout decides where element (n, c, h, w) is stored:
+//     NCHW     ((n * C + c) * H + h) * W + w
+//     NHWC     ((n * H + h) * W + w) * C + c
+//     NCHW8C   (((n * CB + c / 8) * H + h) * W + w) * 8 + c % 8, with CB = ceil(C / 8)
+//     NCHW16C  the same with blocks of 16 channels
+// Blocked layouts keep a block of channels contiguous so kernels can vectorize across channels.
+// They round C up to whole blocks, reorders write the padding channels as zeros.
+class Layout {
+public:
+	enum TYPES {
+		NCHW,
+		NHWC,
+		NCHW8C,
+		NCHW16C
+	};
+
+	static size_t blockSize(TYPES layout) {
+		return layout == NCHW8C ? 8 : layout == NCHW16C ? 16 : 1;
+	}
+
+	static bool isBlocked(TYPES layout) {
+		return blockSize(layout) > 1;
+	}
+
+	// floats occupied by a tensor of this shape, only blocked 4-d tensors take more than the shape
+	static size_t storageSize(const std::vector<size_t>& shape, TYPES layout) {
+		if (shape.size() != 4 || !isBlocked(layout)) {
+			return std::accumulate(shape.begin(), shape.end(), size_t(1), std::multiplies<>());
+		}
+
+		return shape[0] * blocks(shape[1], layout) * blockSize(layout) * shape[2] * shape[3];
+	}
+
+	static size_t offset(const std::vector<size_t>& shape, TYPES layout, size_t n, size_t c, size_t h, size_t w) {
+		const size_t C = shape[1], H = shape[2], W = shape[3];
+
+		switch (layout) {
+		case (NHWC):
+			return ((n * H + h) * W + w) * C + c;
+		case (NCHW8C):
+		case (NCHW16C): {
+			const size_t b = blockSize(layout);
+			return (((n * blocks(C, layout) + c / b) * H + h) * W + w) * b + c % b;
+		}
+		default:
+			return ((n * C + c) * H + h) * W + w;
+		}
+	}
+
+	// Copies a { N, C, H, W } tensor from one layout to another, dst holds storageSize(shape, to) floats
+	static void reorder(const float* src, TYPES from, float* dst, TYPES to, const std::vector<size_t>& shape) {
+		if (from == to) {
+			std::memcpy(dst, src, storageSize(shape, from) * sizeof(float));
+			return;
+		}
+
+		if (from == NCHW) {
+			fromNCHW(src, dst, to, shape);
+		}
+		else if (to == NCHW) {
+			toNCHW(src, from, dst, shape);
+		}
+		else {
+			std::vector<float> nchw(storageSize(shape, NCHW));
+			toNCHW(src, from, nchw.data(), shape);
+			fromNCHW(nchw.data(), dst, to, shape);
+		}
+	}
+
+private:
+	static size_t blocks(size_t channels, TYPES layout) {
+		return (channels + blockSize(layout) - 1) / blockSize(layout);
+	}
+
+	static void fromNCHW(const float* src, float* dst, TYPES to, const std::vector<size_t>& shape) {
+		const size_t N = shape[0], C = shape[1], HW = shape[2] * shape[3];
+
+		if (to == NHWC) {
+#pragma omp parallel for
+			for (size_t n = 0; n < N; n++) {
+				for (size_t c = 0; c < C; c++) {
+					const float* plane = src + (n * C + c) * HW;
+					float* out = dst + n * HW * C + c;
+					for (size_t i = 0; i < HW; i++) out[i * C] = plane[i];
+				}
+			}
+			return;
+		}
+
+		const size_t b = blockSize(to), CB = blocks(C, to);
+
+#pragma omp parallel for
+		for (size_t n = 0; n < N; n++) {
+			for (size_t cb = 0; cb < CB; cb++) {
+				float* block = dst + (n * CB + cb) * HW * b;
+
+				for (size_t i = 0; i < b; i++) {
+					const size_t c = cb * b + i;
+					const float* plane = src + (n * C + c) * HW;
+
+					if (c < C) {
+						for (size_t p = 0; p < HW; p++) block[p * b + i] = plane[p];
+					}
+					else {
+						for (size_t p = 0; p < HW; p++) block[p * b + i] = 0.0f;
+					}
+				}
+			}
+		}
+	}
+
+	static void toNCHW(const float* src, TYPES from, float* dst, const std::vector<size_t>& shape) {
+		const size_t N = shape[0], C = shape[1], HW = shape[2] * shape[3];
+
+		if (from == NHWC) {
+#pragma omp parallel for
+			for (size_t n = 0; n < N; n++) {
+				for (size_t c = 0; c < C; c++) {
+					const float* in = src + n * HW * C + c;
+					float* plane = dst + (n * C + c) * HW;
+					for (size_t i = 0; i < HW; i++) plane[i] = in[i * C];
+				}
+			}
+			return;
+		}
+
+		const size_t b = blockSize(from), CB = blocks(C, from);
+
+#pragma omp parallel for
+		for (size_t n = 0; n < N; n++) {
+			for (size_t c = 0; c < C; c++) {
+				const float* block = src + (n * CB + c / b) * HW * b + c % b;
+				float* plane = dst + (n * C + c) * HW;
+				for (size_t p = 0; p < HW; p++) plane[p] = block[p * b];
+			}
+		}
+	}
+};
\ No newline at end of file
@@ -9,4 +9,16 @@ public:
     virtual float compute(const Tensor& labels, const Tensor& predictions) = 0;
 
     virtual Tensor backward(const Tensor& labels, const Tensor& predictions) = 0;
+
+    // Whether computeFromLogits is implemented. Network then skips a final SOFTMAX_CEL layer in
+    // training and hands its input, the logits, straight to the loss.
+    virtual bool fusesSoftmax() const {
+        return false;
+    }
+
+    // Mean loss of the softmax of a batch of logits, writing the gradient with respect to the
+    // logits to gradient, which may alias logits.
+    virtual float computeFromLogits(const Tensor& labels, const Tensor& logits, Tensor& gradient) {
+        throw std::logic_error("This loss does not fuse the softmax.");
+    }
 };
\ No newline at end of file
@@ -1,6 +1,7 @@
 #pragma once
 
 #include "Tensor.hpp"
+#include "TensorFile.hpp"
 #include <fstream>
 #include <sstream>
 #include <vector>
@@ -8,79 +9,200 @@
 #include <stdexcept>
 #include <utility>
 #include <iostream>
+#include <iterator>
+#include <algorithm>
 
 class MNISTToTensor {
 public:
-    // Parse MNIST CSV file and return a pair of tensors (data, labels)
-    static std::pair<Tensor, Tensor> parseCSV(const char* filename) {
-        std::ifstream fin(filename);
+    // Parse MNIST CSV file and return a pair of tensors (data, labels). Labels are one-hot rows of
+    // 10 classes, or with sparse_labels one class index per sample, 10 times smaller.
+    static std::pair<Tensor, Tensor> parseCSV(const char* filename, bool sparse_labels = false) {
+        std::ifstream fin(filename, std::ios::binary);
         if (!fin.is_open()) {
             throw std::runtime_error("Failed to open the file.");
         }
 
-        std::vector<std::vector<float>> rows;
-        std::string line;
-
-        // Parse rows from the file
-        while (std::getline(fin, line)) {
-            std::stringstream ss(line);
-            std::string token;
-            std::vector<float> row;
-
-            while (std::getline(ss, token, ',')) {
-                try {
-                    row.push_back(static_cast<float>(std::stoi(token)));
-                }
-                catch (const std::invalid_argument& e) {
-                    throw std::runtime_error("Invalid value in CSV: " + token);
-                }
-                catch (const std::out_of_range& e) {
-                    throw std::runtime_error("Value out of range in CSV: " + token);
-                }
-            }
+        // Read the whole file once and parse in place, the tensors are sized up front from the line count
+        std::string text((std::istreambuf_iterator<char>(fin)), std::istreambuf_iterator<char>());
+        fin.close();
 
-            rows.push_back(row);
+        size_t num_samples = 0;
+        for (size_t pos = 0; pos < text.size(); ) {
+            size_t end = text.find('\n', pos);
+            if (end == std::string::npos) end = text.size();
+            if (!isBlank(text, pos, end)) num_samples++;
+            pos = end + 1;
         }
 
-        fin.close();
-
-        if (rows.empty()) {
+        if (num_samples == 0) {
             throw std::runtime_error("The CSV file is empty.");
         }
 
-        size_t num_samples = rows.size();
-        size_t input_size = 28 * 28;
+        const size_t input_size = 28 * 28;
 
         // Initialize tensors for data and labels
         Tensor data({ num_samples, 1, 28, 28 }, 0.0f);
-        Tensor labels({ num_samples, 10 }, 0.0f);
+        Tensor labels = labelTensor(num_samples, sparse_labels);
+
+        float* pixels = data.data.data();
+        float* targets = labels.data.data();
+
+        size_t row_index = 0;
+        for (size_t pos = 0; pos < text.size(); ) {
+            size_t end = text.find('\n', pos);
+            if (end == std::string::npos) end = text.size();
+
+            if (isBlank(text, pos, end)) {
+                pos = end + 1;
+                continue;
+            }
+
+            size_t count = 0;
+            float* row = pixels + row_index * input_size;
 
-        for (size_t row_index = 0; row_index < rows.size(); ++row_index) {
-            const auto& row = rows[row_index];
+            while (pos < end) {
+                int value = parseInt(text, pos, end);
+
+                if (count == 0) {
+                    // Extract label
+                    if (value < 0 || value >= 10) {
+                        throw std::runtime_error("Invalid label value " + std::to_string(value) +
+                            " at row " + std::to_string(row_index) + ".");
+                    }
+                    setLabel(targets, row_index, value, sparse_labels);
+                }
+                else if (count <= input_size) {
+                    // Normalize input data
+                    row[count - 1] = value / 255.0f;
+                }
+                count++;
+            }
 
             // Validate row size
-            if (row.size() != input_size + 1) {
+            if (count != input_size + 1) {
                 throw std::runtime_error("Row " + std::to_string(row_index) + " size (" +
-                    std::to_string(row.size()) + ") does not match expected size (" +
+                    std::to_string(count) + ") does not match expected size (" +
                     std::to_string(input_size + 1) + ").");
             }
 
-            // Extract label and normalize input data
-            int label = static_cast<int>(row[0]);
-            if (label < 0 || label >= 10) {
-                throw std::runtime_error("Invalid label value " + std::to_string(label) +
-                    " at row " + std::to_string(row_index) + ".");
+            row_index++;
+            pos = end + 1;
+        }
+
+        return { std::move(data), std::move(labels) };
+    }
+
+    // Parse an MNIST IDX image/label file pair (big endian headers, unsigned byte data)
+    static std::pair<Tensor, Tensor> parseIDX(const char* images_file, const char* labels_file, bool sparse_labels = false) {
+        std::ifstream images(images_file, std::ios::binary);
+        std::ifstream labels_in(labels_file, std::ios::binary);
+        if (!images.is_open() || !labels_in.is_open()) {
+            throw std::runtime_error("Failed to open the file.");
+        }
+
+        if (readBigEndian(images) != IDX_IMAGES_MAGIC || readBigEndian(labels_in) != IDX_LABELS_MAGIC) {
+            throw std::runtime_error("Not an MNIST IDX file.");
+        }
+
+        size_t num_samples = readBigEndian(images);
+        size_t rows = readBigEndian(images);
+        size_t cols = readBigEndian(images);
+
+        if (readBigEndian(labels_in) != num_samples) {
+            throw std::runtime_error("Image and label counts do not match.");
+        }
+
+        std::vector<unsigned char> pixel_bytes(num_samples * rows * cols);
+        std::vector<unsigned char> label_bytes(num_samples);
+        images.read(reinterpret_cast<char*>(pixel_bytes.data()), pixel_bytes.size());
+        labels_in.read(reinterpret_cast<char*>(label_bytes.data()), label_bytes.size());
+
+        if (!images || !labels_in) {
+            throw std::runtime_error("The IDX file is truncated.");
+        }
+
+        Tensor data({ num_samples, 1, rows, cols }, 0.0f);
+        Tensor labels = labelTensor(num_samples, sparse_labels);
+
+        for (size_t i = 0; i < pixel_bytes.size(); ++i) {
+            data.data[i] = pixel_bytes[i] / 255.0f;
+        }
+
+        for (size_t i = 0; i < num_samples; ++i) {
+            if (label_bytes[i] >= 10) {
+                throw std::runtime_error("Invalid label value " + std::to_string(label_bytes[i]) +
+                    " at row " + std::to_string(i) + ".");
             }
+            setLabel(labels.data.data(), i, label_bytes[i], sparse_labels);
+        }
+
+        return { std::move(data), std::move(labels) };
+    }
+
+    // One-time conversions to tensor files, load the results with MappedTensor
+    static void convertCSV(const char* csv_file, const char* data_file, const char* labels_file, bool sparse_labels = false) {
+        std::pair<Tensor, Tensor> parsed = parseCSV(csv_file, sparse_labels);
+        TensorFile::write(data_file, parsed.first);
+        TensorFile::write(labels_file, parsed.second);
+    }
+
+    static void convertIDX(const char* images_file, const char* labels_idx_file, const char* data_file, const char* labels_file,
+                           bool sparse_labels = false) {
+        std::pair<Tensor, Tensor> parsed = parseIDX(images_file, labels_idx_file, sparse_labels);
+        TensorFile::write(data_file, parsed.first);
+        TensorFile::write(labels_file, parsed.second);
+    }
+
+private:
+    static const uint32_t IDX_IMAGES_MAGIC = 0x00000803;
+    static const uint32_t IDX_LABELS_MAGIC = 0x00000801;
+
+    static Tensor labelTensor(size_t num_samples, bool sparse) {
+        if (sparse) return Tensor({ num_samples }, 0.0f);
+        return Tensor({ num_samples, 10 }, 0.0f);
+    }
+
+    static void setLabel(float* targets, size_t row, int value, bool sparse) {
+        if (sparse) targets[row] = static_cast<float>(value);
+        else targets[row * 10 + value] = 1.0f;
+    }
+
+    static bool isBlank(const std::string& text, size_t begin, size_t end) {
+        return std::all_of(text.begin() + begin, text.begin() + end, [](char c) { return c == ' ' || c == '\r' || c == '\t'; });
+    }
+
+    // Reads one comma separated integer from [pos, end) and moves pos past its separator
+    static int parseInt(const std::string& text, size_t& pos, size_t end) {
+        while (pos < end && (text[pos] == ' ' || text[pos] == '\r')) pos++;
 
-            labels({ row_index, static_cast<size_t>(label) }) = 1.0f;
+        bool negative = pos < end && text[pos] == '-';
+        if (negative) pos++;
 
-            for (size_t input_idx = 0; input_idx < input_size; ++input_idx) {
-                size_t r = input_idx / 28;
-                size_t c = input_idx % 28;
-                data({ row_index, 0, r, c }) = row[input_idx + 1] / 255.0f;
+        size_t begin = pos;
+        long long value = 0;
+        while (pos < end && text[pos] >= '0' && text[pos] <= '9') {
+            value = value * 10 + (text[pos] - '0');
+            if (value > INT32_MAX) {
+                throw std::runtime_error("Value out of range in CSV: " + text.substr(begin, pos - begin + 1));
             }
+            pos++;
         }
 
-        return { data, labels };
+        size_t digits_end = pos;
+        while (pos < end && (text[pos] == ' ' || text[pos] == '\r')) pos++;
+
+        if (digits_end == begin || (pos < end && text[pos] != ',')) {
+            size_t token_end = std::min(text.find(',', begin), end);
+            throw std::runtime_error("Invalid value in CSV: " + text.substr(begin, token_end - begin));
+        }
+
+        if (pos < end) pos++;
+        return static_cast<int>(negative ? -value : value);
+    }
+
+    static uint32_t readBigEndian(std::ifstream& in) {
+        unsigned char bytes[4] = {};
+        in.read(reinterpret_cast<char*>(bytes), 4);
+        return (uint32_t(bytes[0]) << 24) | (uint32_t(bytes[1]) << 16) | (uint32_t(bytes[2]) << 8) | uint32_t(bytes[3]);
     }
 };
@@ -0,0 +1,122 @@
+#pragma once
+
+#include <stdexcept>
+#include <string>
+#include <utility>
+
+#ifdef _WIN32
+#ifndef NOMINMAX
+#define NOMINMAX
+#endif
+#include <windows.h>
+#else
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+
+// A whole file mapped into memory. The mapping is copy-on-write: pages are shared with the page
+// cache (and with every other process mapping the file) until written, and writes never reach
+// the file itself.
+class MappedFile {
+private:
+	char* base = nullptr;
+	size_t length = 0;
+
+#ifdef _WIN32
+	HANDLE file = INVALID_HANDLE_VALUE;
+	HANDLE mapping = nullptr;
+#endif
+
+public:
+	MappedFile() = default;
+
+	explicit MappedFile(const char* path) {
+		open(path);
+	}
+
+	~MappedFile() {
+		close();
+	}
+
+	MappedFile(const MappedFile&) = delete;
+	MappedFile& operator=(const MappedFile&) = delete;
+
+	MappedFile(MappedFile&& other) noexcept {
+		*this = std::move(other);
+	}
+
+	MappedFile& operator=(MappedFile&& other) noexcept {
+		if (this == &other) return *this;
+		close();
+
+		base = other.base;
+		length = other.length;
+		other.base = nullptr;
+		other.length = 0;
+
+#ifdef _WIN32
+		file = other.file;
+		mapping = other.mapping;
+		other.file = INVALID_HANDLE_VALUE;
+		other.mapping = nullptr;
+#endif
+		return *this;
+	}
+
+	void open(const char* path) {
+		close();
+
+#ifdef _WIN32
+		file = CreateFileA(path, GENERIC_READ, FILE_SHARE_READ, nullptr, OPEN_EXISTING, FILE_ATTRIBUTE_NORMAL, nullptr);
+		if (file == INVALID_HANDLE_VALUE) {
+			throw std::runtime_error(std::string("Failed to open ") + path);
+		}
+
+		LARGE_INTEGER size;
+		GetFileSizeEx(file, &size);
+		length = static_cast<size_t>(size.QuadPart);
+
+		mapping = length ? CreateFileMappingA(file, nullptr, PAGE_WRITECOPY, 0, 0, nullptr) : nullptr;
+		base = mapping ? static_cast<char*>(MapViewOfFile(mapping, FILE_MAP_COPY, 0, 0, 0)) : nullptr;
+#else
+		int fd = ::open(path, O_RDONLY);
+		if (fd < 0) {
+			throw std::runtime_error(std::string("Failed to open ") + path);
+		}
+
+		struct stat st;
+		fstat(fd, &st);
+		length = static_cast<size_t>(st.st_size);
+
+		if (length) {
+			void* p = mmap(nullptr, length, PROT_READ | PROT_WRITE, MAP_PRIVATE, fd, 0);
+			base = p == MAP_FAILED ? nullptr : static_cast<char*>(p);
+		}
+		::close(fd);
+#endif
+
+		if (!base) {
+			close();
+			throw std::runtime_error(std::string("Failed to map ") + path);
+		}
+	}
+
+	void close() {
+#ifdef _WIN32
+		if (base) UnmapViewOfFile(base);
+		if (mapping) CloseHandle(mapping);
+		if (file != INVALID_HANDLE_VALUE) CloseHandle(file);
+		mapping = nullptr;
+		file = INVALID_HANDLE_VALUE;
+#else
+		if (base) munmap(base, length);
+#endif
+		base = nullptr;
+		length = 0;
+	}
+
+	char* data() const { return base; }
+	size_t size() const { return length; }
+};
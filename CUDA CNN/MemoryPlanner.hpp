@@ -0,0 +1,83 @@
+#pragma once
+
+#include <vector>
+#include <algorithm>
+
+// Static memory planner: buffers are requested with the steps at which they are first and last
+// used, and plan() gives each one an offset in a single arena so that buffers whose lifetimes
+// overlap never share memory. Placement is greedy, largest buffer first, lowest free offset.
+class MemoryPlanner {
+private:
+	// offsets are kept on 16 float (64 byte) boundaries
+	static const size_t ALIGNMENT = 16;
+
+	struct Buffer {
+		size_t size;
+		size_t first;
+		size_t last;
+		size_t offset;
+	};
+
+	std::vector<Buffer> buffers;
+
+public:
+	// id of no buffer, for values that live outside the plan
+	static const size_t NONE = static_cast<size_t>(-1);
+
+	void clear() {
+		buffers.clear();
+	}
+
+	// size in floats, lifetime is the inclusive range of steps [first, last]; returns the buffer id
+	size_t request(size_t size, size_t first, size_t last) {
+		buffers.push_back({ (size + ALIGNMENT - 1) / ALIGNMENT * ALIGNMENT, first, last, 0 });
+		return buffers.size() - 1;
+	}
+
+	// widens the lifetime of buffer id to end no earlier than step last
+	void extend(size_t id, size_t last) {
+		buffers[id].last = std::max(buffers[id].last, last);
+	}
+
+	// Assigns every offset and returns the arena size (in floats) needed for the plan
+	size_t plan() {
+		std::vector<size_t> order(buffers.size());
+		for (size_t i = 0; i < order.size(); i++) order[i] = i;
+
+		std::stable_sort(order.begin(), order.end(), [this](size_t a, size_t b) {
+			return buffers[a].size > buffers[b].size;
+		});
+
+		std::vector<size_t> placed;
+		size_t arena_size = 0;
+
+		for (size_t id : order) {
+			Buffer& buffer = buffers[id];
+
+			// placed buffers alive at the same time, by offset
+			std::vector<size_t> live;
+			for (size_t other : placed) {
+				if (buffers[other].first <= buffer.last && buffer.first <= buffers[other].last) live.push_back(other);
+			}
+			std::sort(live.begin(), live.end(), [this](size_t a, size_t b) {
+				return buffers[a].offset < buffers[b].offset;
+			});
+
+			size_t offset = 0;
+			for (size_t other : live) {
+				if (offset + buffer.size <= buffers[other].offset) break;
+				offset = std::max(offset, buffers[other].offset + buffers[other].size);
+			}
+
+			buffer.offset = offset;
+			arena_size = std::max(arena_size, offset + buffer.size);
+			placed.push_back(id);
+		}
+
+		return arena_size;
+	}
+
+	size_t offset(size_t id) const {
+		return buffers[id].offset;
+	}
+};
@@ -0,0 +1,235 @@
+#pragma once
+
+#include "MappedFile.hpp"
+#include "ConvLayer.hpp"
+#include "DenseLayer.hpp"
+#include "PoolLayer.hpp"
+#include "ActivationLayer.hpp"
+#include "FlattenLayer.hpp"
+#include "BatchNormLayer.hpp"
+#include "DropoutLayer.hpp"
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
+#include <fstream>
+#include <memory>
+#include <string>
+
+// Versioned binary model file:
+//
+//     ModelHeader | LayerRecord[layer_count] | weights and biases, each on a 64 byte boundary
+//
+// A record holds everything needed to rebuild its layer: the type tag, activation, constructor
+// arguments and the shapes and file offsets of its weights and biases. Parameters are raw
+// little-endian float32, aligned so they can be used in place from a memory mapping.
+class ModelFile {
+public:
+	static const uint32_t VERSION = 1;
+	static const uint32_t MAX_RANK = 8;
+	static const uint32_t MAX_HYPERPARAMETERS = 8;
+	static const uint64_t DATA_ALIGNMENT = 64;
+
+	struct ModelHeader {
+		char magic[8];
+		uint32_t version;
+		uint32_t layer_count;
+		uint32_t input_rank;
+		uint32_t reserved;
+		uint64_t input_shape[MAX_RANK];
+	};
+
+	struct LayerRecord {
+		char type[16];
+		uint32_t activation;
+		uint32_t hyperparameter_count;
+		double hyperparameters[MAX_HYPERPARAMETERS];
+		uint32_t weight_rank;
+		uint32_t bias_rank;
+		uint64_t weight_shape[MAX_RANK];
+		uint64_t bias_shape[MAX_RANK];
+		uint64_t weight_offset;
+		uint64_t bias_offset;
+	};
+
+	static void save(const char* path, const std::vector<size_t>& input_shape, const std::vector<Layer*>& layers) {
+		if (input_shape.size() > MAX_RANK) {
+			throw std::invalid_argument("Input rank is too large for the model file format.");
+		}
+
+		ModelHeader header = {};
+		std::memcpy(header.magic, MAGIC, sizeof(header.magic));
+		header.version = VERSION;
+		header.layer_count = static_cast<uint32_t>(layers.size());
+		header.input_rank = static_cast<uint32_t>(input_shape.size());
+		for (size_t i = 0; i < input_shape.size(); i++) header.input_shape[i] = input_shape[i];
+
+		// lay the parameters out after the records, each tensor on its own aligned offset
+		std::vector<LayerRecord> records(layers.size());
+		uint64_t offset = align(sizeof(ModelHeader) + layers.size() * sizeof(LayerRecord));
+
+		for (size_t i = 0; i < layers.size(); i++) {
+			records[i] = describe(*layers[i]);
+
+			records[i].weight_offset = offset;
+			offset = align(offset + layers[i]->weights.data.size() * sizeof(float));
+			records[i].bias_offset = offset;
+			offset = align(offset + layers[i]->biases.data.size() * sizeof(float));
+		}
+
+		std::ofstream fout(path, std::ios::binary);
+		if (!fout.is_open()) {
+			throw std::runtime_error(std::string("Failed to create ") + path);
+		}
+
+		fout.write(reinterpret_cast<const char*>(&header), sizeof(header));
+		fout.write(reinterpret_cast<const char*>(records.data()), records.size() * sizeof(LayerRecord));
+
+		uint64_t position = sizeof(header) + records.size() * sizeof(LayerRecord);
+		for (size_t i = 0; i < layers.size(); i++) {
+			writeAt(fout, position, records[i].weight_offset, layers[i]->weights);
+			writeAt(fout, position, records[i].bias_offset, layers[i]->biases);
+		}
+
+		if (!fout) {
+			throw std::runtime_error(std::string("Failed to write ") + path);
+		}
+	}
+
+	// Rebuilds the layers of a mapped model file with their weights and biases bound to the
+	// mapping, the mapping must outlive the layers. Layers are allocated with new.
+	static std::vector<Layer*> load(const MappedFile& file, std::vector<size_t>& input_shape) {
+		if (file.size() < sizeof(ModelHeader)) {
+			throw std::runtime_error("File is too small to be a model file.");
+		}
+
+		ModelHeader header;
+		std::memcpy(&header, file.data(), sizeof(header));
+
+		if (std::memcmp(header.magic, MAGIC, sizeof(header.magic)) || header.version != VERSION) {
+			throw std::runtime_error("Not a model file, or unsupported version.");
+		}
+		if (header.input_rank > MAX_RANK || sizeof(ModelHeader) + uint64_t(header.layer_count) * sizeof(LayerRecord) > file.size()) {
+			throw std::runtime_error("Model file is corrupt.");
+		}
+
+		input_shape = toShape(header.input_shape, header.input_rank);
+
+		// owned until every record is read, a corrupt record must not leak the layers before it
+		std::vector<std::unique_ptr<Layer>> layers;
+		for (uint32_t i = 0; i < header.layer_count; i++) {
+			LayerRecord record;
+			std::memcpy(&record, file.data() + sizeof(ModelHeader) + i * sizeof(LayerRecord), sizeof(record));
+
+			if (record.hyperparameter_count > MAX_HYPERPARAMETERS || record.weight_rank > MAX_RANK || record.bias_rank > MAX_RANK) {
+				throw std::runtime_error("Model file is corrupt.");
+			}
+
+			record.type[sizeof(record.type) - 1] = '\0';
+			std::vector<double> hyperparameters(record.hyperparameters, record.hyperparameters + record.hyperparameter_count);
+
+			std::unique_ptr<Layer> layer(createLayer(record.type, static_cast<ActivationFunctions::TYPES>(record.activation), hyperparameters));
+
+			if (record.weight_rank) {
+				std::vector<size_t> weight_shape = toShape(record.weight_shape, record.weight_rank);
+				std::vector<size_t> bias_shape = toShape(record.bias_shape, record.bias_rank);
+
+				layer->setParameters(Tensor::bind(weight_shape, mapped(file, record.weight_offset, weight_shape)),
+									 Tensor::bind(bias_shape, mapped(file, record.bias_offset, bias_shape)));
+			}
+
+			layers.push_back(std::move(layer));
+		}
+
+		std::vector<Layer*> result;
+		for (std::unique_ptr<Layer>& layer : layers) result.push_back(layer.release());
+		return result;
+	}
+
+	// Layer factory keyed on Layer::getType
+	static Layer* createLayer(const std::string& type, ActivationFunctions::TYPES activation, const std::vector<double>& h) {
+		auto arg = [&](size_t i) {
+			if (i >= h.size()) throw std::runtime_error("Missing hyperparameters for layer " + type + ".");
+			return h[i];
+		};
+
+		if (type == "Conv") {
+			return new ConvLayer(size_t(arg(0)), size_t(arg(1)), size_t(arg(2)), size_t(arg(3)), size_t(arg(4)), activation);
+		}
+		if (type == "Dense") return new DenseLayer(size_t(arg(0)), activation);
+		if (type == "Pool") return new PoolLayer(size_t(arg(0)), size_t(arg(1)), activation);
+		if (type == "Activation") return new ActivationLayer(activation);
+		if (type == "Flatten") return new FlattenLayer();
+		if (type == "BatchNorm") return new BatchNormLayer();
+		if (type == "Dropout") return new DropoutLayer(float(arg(0)));
+
+		throw std::runtime_error("Unknown layer type " + type + ".");
+	}
+
+private:
+	static constexpr const char* MAGIC = "CNNMODEL";
+
+	static uint64_t align(uint64_t offset) {
+		return (offset + DATA_ALIGNMENT - 1) / DATA_ALIGNMENT * DATA_ALIGNMENT;
+	}
+
+	static LayerRecord describe(const Layer& layer) {
+		LayerRecord record = {};
+
+		std::string type = layer.getType();
+		std::vector<double> hyperparameters = layer.getHyperparameters();
+		const std::vector<size_t>& weight_shape = layer.weights.getShape();
+		const std::vector<size_t>& bias_shape = layer.biases.getShape();
+
+		if (type.size() >= sizeof(record.type) || hyperparameters.size() > MAX_HYPERPARAMETERS ||
+			weight_shape.size() > MAX_RANK || bias_shape.size() > MAX_RANK) {
+			throw std::invalid_argument("Layer " + type + " does not fit the model file format.");
+		}
+
+		std::memcpy(record.type, type.c_str(), type.size());
+		record.activation = static_cast<uint32_t>(layer.getActivationFunction());
+		record.hyperparameter_count = static_cast<uint32_t>(hyperparameters.size());
+		std::copy(hyperparameters.begin(), hyperparameters.end(), record.hyperparameters);
+
+		// layers without parameters keep rank 0
+		if (!layer.weights.data.empty()) {
+			record.weight_rank = static_cast<uint32_t>(weight_shape.size());
+			record.bias_rank = static_cast<uint32_t>(bias_shape.size());
+			std::copy(weight_shape.begin(), weight_shape.end(), record.weight_shape);
+			std::copy(bias_shape.begin(), bias_shape.end(), record.bias_shape);
+		}
+
+		return record;
+	}
+
+	static void writeAt(std::ofstream& fout, uint64_t& position, uint64_t offset, const Tensor& tensor) {
+		std::vector<char> padding(offset - position, 0);
+		fout.write(padding.data(), padding.size());
+		fout.write(reinterpret_cast<const char*>(tensor.data.data()), tensor.data.size() * sizeof(float));
+		position = offset + tensor.data.size() * sizeof(float);
+	}
+
+	static std::vector<size_t> toShape(const uint64_t* dims, uint32_t rank) {
+		return std::vector<size_t>(dims, dims + rank);
+	}
+
+	// Pointer to a tensor of the given shape inside the mapping, bounds checked. Offsets and dims
+	// come from the file, so the element count is checked against the space left by division
+	// instead of being multiplied out, which could wrap around.
+	static float* mapped(const MappedFile& file, uint64_t offset, const std::vector<size_t>& shape) {
+		if (offset % DATA_ALIGNMENT || offset > file.size()) {
+			throw std::runtime_error("Model file is truncated or corrupt.");
+		}
+
+		const uint64_t available = (file.size() - offset) / sizeof(float);
+		uint64_t count = 1;
+
+		for (size_t dim : shape) {
+			if (dim && count > available / dim) {
+				throw std::runtime_error("Model file is truncated or corrupt.");
+			}
+			count *= dim;
+		}
+
+		return reinterpret_cast<float*>(file.data() + offset);
+	}
+};
\ No newline at end of file
@@ -3,17 +3,78 @@
 #include "Layer.hpp"
 #include "Loss.hpp"
 #include "Optimizer.hpp"
+#include "ParameterArena.hpp"
+#include "MemoryPlanner.hpp"
+#include "BatchPipeline.hpp"
+#include "ModelFile.hpp"
+#include "ReorderLayer.hpp"
+#include "Parallel.hpp"
+#include "UpdateStream.hpp"
+#include "Profiler.hpp"
 #include <iostream>
+#include <memory>
+
+// Result of Network::evaluate
+struct Evaluation {
+	float loss;           // mean loss per sample, 0 when no loss function is set
+	float accuracy;       // top-1 accuracy
+	float top_k_accuracy; // fraction of samples whose label is among the top_k predictions
+	size_t top_k;
+	size_t samples;
+};
 
 class Network {
 private: 
 	std::vector<Layer*> layers;
 	Loss* loss_function = nullptr;
 	Optimizer* optimizer = nullptr;
+	ParameterArena parameters;
+
+	// every layer output and input gradient lives here, laid out by planActivations. Layers write
+	// their buffers before reading them, so the arena is not zeroed.
+	TensorBuffer activation_arena;
+
+	// mapping of a loaded model, its layers read weights and biases straight from it
+	MappedFile model_file;
 
 	std::vector<size_t> input_shape;
-	Tensor batch_input;
-	Tensor batch_labels;
+	bool shuffle = true;
+
+	// compiled with compileForInference: forward only, no gradients, optimizer or parameter arena
+	bool inference = false;
+
+	// activation layout used in inference, and the reorders compile inserted into layers for it
+	Layout::TYPES layout = Layout::NCHW;
+	std::vector<std::unique_ptr<ReorderLayer>> reorders;
+
+	// storage precision of the Conv and Dense weights the kernels read, see setPrecision
+	Precision::TYPES precision = Precision::FLOAT32;
+
+	// data-parallel training: fit splits each batch over this network and workers - 1 replicas
+	size_t workers = 1;
+	std::vector<std::unique_ptr<Network>> replicas;
+	std::vector<std::unique_ptr<Layer>> replica_layers;
+
+	// gradient floats summed per task by the all-reduce
+	static const size_t REDUCE_CHUNK = 1 << 14;
+
+	// Gradients of the last micro-batch of a step are handed to the update stream in buckets
+	// during backward, the stream sums them over the processes of the transport's ring when
+	// distributed and applies the optimizer. parameter_offsets[i] is where the parameters of
+	// layer i start in the arena.
+	Transport* transport = nullptr;
+	std::unique_ptr<UpdateStream> stream;
+	std::vector<size_t> parameter_offsets;
+
+	// micro-batches whose gradients are summed into each optimizer step
+	size_t accumulation_steps = 1;
+
+	// gradient floats per bucket, large enough to keep the ring bandwidth bound
+	static const size_t GRADIENT_BUCKET = 1 << 18;
+
+	// per-layer timings of predict and backward, only collected while profiling is on
+	Profiler profiler;
+	bool profiling = false;
 
 public: 
 	void add(Layer* layer) {
@@ -26,43 +87,164 @@ public:
 
 	void compile(Loss* _loss_function, Optimizer* _optimizer) {
 		if (!input_shape.size())
-			throw std::exception("input shape must be set.");
+			throw std::runtime_error("input shape must be set.");
 		loss_function = _loss_function;
 		optimizer = _optimizer;
+		inference = false;
+		clearReplicas();
+		profiler.reset();
 
-		std::vector<size_t> next_shape = input_shape;
-		Tensor* next_input = nullptr;
+		initializeLayers();
 
-		// default # of batches to 1
-		next_shape.insert(next_shape.begin(), 1);
+		// all weights, biases and their gradients move into one flat buffer
+		registerParameters();
+		parameters.allocate();
+
+		stream.reset(new UpdateStream(transport));
+
+		// every process starts from the parameters of rank 0
+		if (transport) {
+			Collectives::broadcast(*transport, parameters.data(), parameters.size());
+			refreshHalfWeights();
+		}
+	}
+
+	// Prepares the network for predict and evaluate only. No gradient, optimizer or parameter
+	// arena state is allocated and layer outputs are planned ping-pong style, each one only living
+	// until the next layer has read it. The loss is optional, evaluate reports it when given.
+	void compileForInference(Loss* _loss_function = nullptr) {
+		if (!input_shape.size())
+			throw std::runtime_error("input shape must be set.");
+		loss_function = _loss_function;
+		optimizer = nullptr;
+		inference = true;
+		clearReplicas();
+		stream.reset();
+		profiler.reset();
+
+		// trained parameters move out of the arena, which is released together with the gradients
+		if (parameters.size()) {
+			for (Layer* layer : layers) {
+				if (layer->getWeightGradient()) layer->setParameters(Tensor(layer->weights), Tensor(layer->biases));
+			}
+
+			parameters.clear();
+			parameters.allocate();
+		}
+
+		initializeLayers();
+	}
+
+	// Activation layout for an inference network. Layers that run natively in it (Conv, Pool and
+	// element-wise activations on 4-d data) switch to it on compileForInference, and reorders are
+	// inserted only where the layout changes, including back to NCHW before Flatten or the output.
+	void setLayout(Layout::TYPES _layout) {
+		layout = _layout;
+	}
+
+	// Post-training INT8 quantization of every Conv and Dense layer. The calibration data first runs
+	// through the float network to find the largest absolute input of each of those layers, which
+	// sets its per-tensor activation scale; weights get one scale per output channel. predict and
+	// evaluate then use the int8 kernels. The float weights are kept for save and further training.
+	void quantize(const Tensor& calibration_data, size_t batch_size = 256) {
+		if (!inference) {
+			throw std::logic_error("The network must be compiled for inference before quantizing.");
+		}
+
+		const size_t samples = calibration_data.getShape()[0];
+		if (!samples) {
+			throw std::invalid_argument("Calibration needs at least one sample.");
+		}
+
+		batch_size = std::min(batch_size, samples);
+		std::vector<float> ranges(layers.size(), 0.0f);
+
+		for (Layer* layer : layers) layer->dequantize();
+
+		for (size_t start = 0; start < samples; start += batch_size) {
+			size_t rows = std::min(batch_size, samples - start);
+
+			// relink for the first batch and for a smaller last batch
+			if (start == 0 || rows != batch_size) linkLayers(rows);
+
+			Tensor batch = calibration_data.rows(start, rows);
+			layers[0]->setInput(&batch);
+
+			// inputs are read before each forward, as inference buffers are reused further down
+			for (size_t i = 0; i < layers.size(); i++) {
+				if (layers[i]->supportsQuantization()) {
+					ranges[i] = std::max(ranges[i], absMax(*layers[i]->getInput()));
+				}
+				step(i);
+			}
+		}
 
 		for (size_t i = 0; i < layers.size(); i++) {
-			layers[i]->initialize(next_shape);
-			next_shape = layers[i]->getOutputShape();
+			if (layers[i]->supportsQuantization()) layers[i]->quantize(ranges[i]);
+		}
+	}
+
+	// Writes the input shape, layer topology and all weights and biases to a model file
+	void save(const char* path) const {
+		ModelFile::save(path, input_shape, modelLayers());
+	}
+
+	// Rebuilds an empty network from a model file. Weights and biases are used in place from a
+	// copy-on-write mapping of the file, so loading copies nothing and every process serving the
+	// same model shares one physical copy. The network comes back compiled for inference; compile
+	// copies the parameters into the arena to train further.
+	void load(const char* path) {
+		if (!layers.empty()) {
+			throw std::invalid_argument("Models can only be loaded into an empty network.");
 		}
+
+		model_file.open(path);
+		layers = ModelFile::load(model_file, input_shape);
+		compileForInference();
 	}
 
 	void linkLayers(size_t batches) {
 		if (!input_shape.size())
-			throw std::exception("input shape must be set.");
+			throw std::runtime_error("input shape must be set.");
 
-		std::vector<size_t> next_shape = input_shape;
+		MemoryPlanner planner;
+		std::vector<size_t> outputs, gradients;
+		size_t arena_size = planActivations(batches, planner, outputs, gradients);
+
+		// the arena only grows, relinking at a smaller batch size reuses it
+		if (arena_size > activation_arena.size()) {
+			activation_arena = TensorBuffer::uninitialized(arena_size);
+		}
 
-		next_shape.insert(next_shape.begin(), batches);
 		Tensor* next_input = nullptr;
 
 		for (size_t i = 0; i < layers.size(); i++) {
 			layers[i]->initOutput(batches);
+
+			if (layers[i]->isView()) {
+				layers[i]->bindView();
+			}
+			else {
+				layers[i]->bindBuffers(activation_arena.data() + planner.offset(outputs[i]),
+									   inference ? nullptr : activation_arena.data() + planner.offset(gradients[i]));
+			}
 			layers[i]->setInput(next_input);
 
 			next_input = layers[i]->getOutput();
-			next_shape = layers[i]->getOutput()->getShape();
 		}
 	}
 
+	// Peak memory, in bytes, of all layer outputs and input gradients for one training
+	// step (one forward pass once compiled for inference) at the given batch size
+	size_t peakActivationMemory(size_t batch_size) const {
+		MemoryPlanner planner;
+		std::vector<size_t> outputs, gradients;
+		return planActivations(batch_size, planner, outputs, gradients) * sizeof(float);
+	}
+
 	Tensor* step(size_t ind) {
 		if (ind >= layers.size() || !layers[ind]->getInput())
-			throw std::exception("Must add layers, or must set input, or must compile network.");
+			throw std::runtime_error("Must add layers, or must set input, or must compile network.");
 
 		layers[ind]->forward();
 		return layers[ind]->getOutput();
@@ -74,57 +256,155 @@ public:
 			size_t batch_size, 
 			std::function<void()> pre_epoch = 0)
 	{
+		if (inference || !optimizer) {
+			throw std::logic_error("The network must be compiled for training before calling fit.");
+		}
+
+		// batches are gathered in the background while the previous one trains
+		BatchPipeline pipeline(training_data, labels, batch_size, shuffle);
+
+		// a rank running out of batches early would leave the others waiting in an all-reduce
+		if (transport) {
+			float batches = static_cast<float>(pipeline.batchesPerEpoch()), total = batches;
+			std::vector<float> scratch;
+			Collectives::allReduce(*transport, &total, 1, scratch);
+
+			if (total != batches * transport->size()) {
+				throw std::invalid_argument("Every rank must train on the same number of batches.");
+			}
+		}
+
 		for (size_t i = 0; i < epochs; i++) {
-			train_epoch(training_data, labels, batch_size);
+			train_epoch(pipeline);
 			std::cout << "Epoch " << i + 1 << " completed." << std::endl;
-			pre_epoch();
+			if (pre_epoch) pre_epoch();
 		}
 	}
 
-	float one_hot_accuracy(const Tensor& training_data, const Tensor& labels) {
-		std::vector<size_t> bi_shape = training_data.getShape(), bl_shape = labels.getShape();
-		bi_shape[0] = bl_shape[0] = 1;
+	// Synchronous data-parallel training over the given number of workers (1, the default, turns it
+	// off; 0 uses one per core). fit splits every batch into one shard per worker, each worker runs
+	// forward and backward on its shard with its own activations and gradients, the gradients are
+	// summed by a tree all-reduce and a single optimizer step updates the shared parameters.
+	void setDataParallel(size_t _workers) {
+		workers = _workers ? _workers : static_cast<size_t>(Parallel::maxThreads());
+		clearReplicas();
+	}
 
-		batch_input = Tensor(bi_shape);
-		batch_labels = Tensor(bl_shape);
+	// Distributed data-parallel training with one network per process. fit sums the gradients of
+	// every batch over all ranks of the transport with ring all-reduces, overlapped with backward,
+	// before each optimizer step, and compile starts every rank from the parameters of rank 0. Each
+	// rank passes its own share of the training data to fit, with the same batch size and number of
+	// batches. nullptr goes back to training alone. The transport must outlive the network.
+	void setDistributed(Transport* _transport) {
+		transport = _transport;
+
+		if (optimizer && !inference) {
+			stream.reset(new UpdateStream(transport));
+			if (transport) {
+				Collectives::broadcast(*transport, parameters.data(), parameters.size());
+				refreshHalfWeights();
+			}
+		}
+	}
 
-		linkLayers(1);
+	// Storage precision of the weights read by the Conv and Dense kernels, FLOAT32 by default.
+	// BFLOAT16 or FLOAT16 gives each of those layers a 16 bit copy of its weights, halving the
+	// weight memory traffic of forward and backward, while the GEMMs widen the operands as they
+	// pack them and accumulate in fp32. Activations and gradients stay fp32, and training keeps
+	// the fp32 weights as master copy: the optimizer updates them and the copies are refreshed
+	// after every step. Conv reads the copy on its im2col and pointwise paths; the direct,
+	// Winograd and blocked kernels and the int8 ones of quantize are unaffected. Takes effect
+	// at once on a compiled network.
+	void setPrecision(Precision::TYPES _precision) {
+		precision = _precision;
+		for (Layer* layer : layers) layer->setPrecision(precision);
+		for (auto& replica : replicas) replica->setPrecision(precision);
+	}
 
-		float res = 0.0f;
+	Precision::TYPES getPrecision() const {
+		return precision;
+	}
 
-		for (int i = 0; i < training_data.getShape()[0]; i++) {
-			setBatch(batch_input, training_data, i, 1);
-			setBatch(batch_labels, labels, i, 1);
+	// Sums the gradients of steps consecutive batches of fit into each optimizer step, so the
+	// effective batch is steps times the batch size while activations stay sized for one batch.
+	// The last step of an epoch takes whatever batches are left. 1, the default, updates after
+	// every batch.
+	void setGradientAccumulation(size_t steps) {
+		if (!steps) {
+			throw std::invalid_argument("Gradient accumulation needs at least one step.");
+		}
+		accumulation_steps = steps;
+	}
 
-			Tensor* predictions = predict(&batch_input);
+	// Per-layer profiling of predict and backward, off by default. When off the only cost is a
+	// branch per layer. With data-parallel workers only the shard of the first worker is timed.
+	void setProfiling(bool _profiling) {
+		profiling = _profiling;
+	}
 
-			float mx = -1e9;
-			size_t m = 0;
-			for (int j = 0; j < predictions->data.size(); j++) {
-				if (predictions->data[j] > mx) {
-					m = j;
-					mx = predictions->data[j];
-				}
-			}
+	void resetProfile() {
+		profiler.reset();
+	}
 
-			for (int j = 0; j < labels.data.size(); j++) {
-				if (labels.data[j] > 0) {
-					res += j == m;
-					break;
-				}
-			}
-		}
+	const Profiler& getProfile() const {
+		return profiler;
+	}
 
-		return res / static_cast<float>(training_data.getShape()[0]);
+	// Table of forward and backward time, calls, GFLOP/s and GB/s per layer, the most expensive
+	// first. Compiling the network resets the counters.
+	std::string profileReport() const {
+		return profiler.report();
 	}
-	
-	Tensor* predict(Tensor* input) {
-		layers[0]->setInput(input);
 
-		for (size_t i = 0; i < layers.size(); i++) {
-			step(i);
+	// Whether fit visits the samples in a new random order every epoch, on by default
+	void setShuffle(bool _shuffle) {
+		shuffle = _shuffle;
+	}
+
+	// Runs the data through the network, forward only, in batches of batch_size and reports
+	// the mean loss together with top-1 and top-k accuracy against one-hot or sparse labels.
+	Evaluation evaluate(const Tensor& data, const Tensor& labels, size_t batch_size = 256, size_t top_k = 5) {
+		const size_t samples = data.getShape()[0];
+		if (labels.getShape()[0] != samples) {
+			throw std::invalid_argument("Data and labels must have the same number of samples.");
 		}
 
+		Evaluation result = { 0.0f, 0.0f, 0.0f, top_k, samples };
+		if (!samples) return result;
+
+		batch_size = std::min(batch_size, samples);
+
+		double loss = 0.0;
+		size_t correct = 0, correct_k = 0;
+
+		for (size_t start = 0; start < samples; start += batch_size) {
+			size_t rows = std::min(batch_size, samples - start);
+
+			// relink for the first batch and for a smaller last batch
+			if (start == 0 || rows != batch_size) linkLayers(rows);
+
+			// the batch is read in place from the data
+			Tensor batch_input = data.rows(start, rows);
+			const Tensor batch_labels = labels.rows(start, rows);
+
+			Tensor* predictions = predict(&batch_input);
+
+			if (loss_function) loss += loss_function->compute(batch_labels, *predictions) * rows;
+			countCorrect(*predictions, batch_labels, top_k, correct, correct_k);
+		}
+
+		result.loss = static_cast<float>(loss / samples);
+		result.accuracy = static_cast<float>(correct) / samples;
+		result.top_k_accuracy = static_cast<float>(correct_k) / samples;
+		return result;
+	}
+
+	float one_hot_accuracy(const Tensor& training_data, const Tensor& labels) {
+		return evaluate(training_data, labels).accuracy;
+	}
+	
+	Tensor* predict(Tensor* input) {
+		forward(input, layers.size());
 		return layers.back()->getOutput();
 	}
 
@@ -138,55 +418,399 @@ private:
 		for (auto& a : s) std::cout << a << std::endl;
 	}
 
-	void backward(Tensor& loss_gradient) {
+	// Liveness over one training step of L layers: forward of layer i runs at step i, the loss at
+	// step L and backward of layer i at step 2L - i. An output is read up to the backward of its own
+	// layer, an input gradient only by the backward of the layer before, so gradient buffers are
+	// recycled as the backward pass moves down the network. The input gradient of the last layer
+	// is live from the loss on, a loss fusing a final softmax writes its gradient there. In
+	// inference an output only lives from its own forward to the next one, so consecutive layers
+	// ping-pong between two buffers.
+	// View layers get no buffers (MemoryPlanner::NONE). Their output is the output of the layer
+	// before, which then lives until the view's output was last read, and their input gradient
+	// is the input gradient of the layer after, which lives until the layer before has read it.
+	size_t planActivations(size_t batches, MemoryPlanner& planner,
+						   std::vector<size_t>& outputs, std::vector<size_t>& gradients) const
+	{
+		const size_t L = layers.size();
+		size_t input_size = batches * std::accumulate(input_shape.begin(), input_shape.end(), size_t(1), std::multiplies<>());
+
+		// buffer holding the current activation, NONE for the network input
+		size_t activation = MemoryPlanner::NONE;
+
+		for (size_t i = 0; i < L; i++) {
+			if (layers[i]->isView()) {
+				outputs.push_back(size_t(MemoryPlanner::NONE));
+				if (!inference) gradients.push_back(size_t(MemoryPlanner::NONE));
+				if (activation != MemoryPlanner::NONE) planner.extend(activation, inference ? i + 1 : 2 * L - i);
+				continue;
+			}
+
+			std::vector<size_t> shape = layers[i]->getOutputShape();
+			shape[0] = batches;
+			size_t output_size = Layout::storageSize(shape, layers[i]->getOutputLayout());
+
+			if (inference) {
+				outputs.push_back(activation = planner.request(output_size, i, i + 1));
+				continue;
+			}
+
+			outputs.push_back(activation = planner.request(output_size, i, 2 * L - i));
+			gradients.push_back(planner.request(input_size, i + 1 == L ? L : 2 * L - i, 2 * L - i + 1));
+
+			input_size = output_size;
+		}
+
+		// a view at the end passes the loss gradient through, which is not planned
+		for (size_t i = L; i-- > 0 && !inference;) {
+			if (!layers[i]->isView()) continue;
+
+			gradients[i] = i + 1 < L ? gradients[i + 1] : size_t(MemoryPlanner::NONE);
+			if (gradients[i] != MemoryPlanner::NONE) planner.extend(gradients[i], 2 * L - i + 1);
+		}
+
+		return planner.plan();
+	}
+
+	// Computes every layer shape from the input shape (with a batch size of 1), initializing
+	// parameters that were not loaded, and lets each layer fuse with the one before it
+	void initializeLayers() {
+		// reorders of a previous compile are planned again from scratch
+		layers = modelLayers();
+		reorders.clear();
+
+		std::vector<size_t> next_shape = input_shape;
+
+		// default # of batches to 1
+		next_shape.insert(next_shape.begin(), 1);
+
+		for (size_t i = 0; i < layers.size(); i++) {
+			layers[i]->dequantize();
+			layers[i]->setInference(inference);
+			layers[i]->setLayout(Layout::NCHW);
+			layers[i]->initialize(next_shape);
+			next_shape = layers[i]->getOutputShape();
+		}
+
+		if (inference && layout != Layout::NCHW) planLayouts();
+
+		for (size_t i = 0; i < layers.size(); i++) {
+			layers[i]->fuseActivation(i ? layers[i - 1] : nullptr);
+			layers[i]->setPrecision(precision);
+		}
+	}
+
+	// reconverts the 16 bit weights of this network and its replicas from the fp32 parameters
+	void refreshHalfWeights() {
+		if (precision == Precision::FLOAT32) return;
+
+		for (Layer* layer : layers) layer->refreshHalfWeights();
+		for (auto& replica : replicas) replica->refreshHalfWeights();
+	}
+
+	// Moves every 4-d layer that supports it to the requested layout and inserts a ReorderLayer
+	// wherever consecutive layers disagree, and at the end if the output is not NCHW
+	void planLayouts() {
+		std::vector<Layer*> planned;
+		Layout::TYPES current = Layout::NCHW;
+
+		std::vector<size_t> shape = input_shape;
+		shape.insert(shape.begin(), 1);
+
+		auto reorderTo = [&](Layout::TYPES to) {
+			reorders.emplace_back(new ReorderLayer(current, to));
+			reorders.back()->setInference(true);
+			reorders.back()->initialize(shape);
+			planned.push_back(reorders.back().get());
+			current = to;
+		};
+
+		for (Layer* layer : layers) {
+			Layout::TYPES wanted = shape.size() == 4 && layer->supportsLayout(layout) ? layout : Layout::NCHW;
+			if (wanted != current) reorderTo(wanted);
+
+			layer->setLayout(wanted);
+			planned.push_back(layer);
+			shape = layer->getOutputShape();
+		}
+
+		if (current != Layout::NCHW) reorderTo(Layout::NCHW);
+		layers.swap(planned);
+	}
+
+	// the layers added by the user, without inserted reorders
+	std::vector<Layer*> modelLayers() const {
+		std::vector<Layer*> result;
+		for (Layer* layer : layers) {
+			bool inserted = std::any_of(reorders.begin(), reorders.end(),
+				[layer](const std::unique_ptr<ReorderLayer>& r) { return r.get() == layer; });
+			if (!inserted) result.push_back(layer);
+		}
+		return result;
+	}
+
+	// Forward through the first count layers
+	void forward(Tensor* input, size_t count) {
+		layers[0]->setInput(input);
+
+		for (size_t i = 0; i < count; i++) {
+			Profiler::Clock::time_point start;
+			if (profiling) start = Profiler::now();
+
+			step(i);
+
+			if (profiling) profiler.forward(i, *layers[i], start);
+		}
+	}
+
+	// Backward through the first count layers, from layer count - 1 down. Given an update stream,
+	// the parameters of consecutive layers are submitted to it in buckets as soon as their backward
+	// is done, so their reduction and update overlap with backward of the earlier layers. A layer's
+	// update cannot disturb the earlier layers, their backward only reads their own weights.
+	void backward(Tensor& loss_gradient, size_t count, UpdateStream* update_stream = nullptr) {
+		size_t bucket_end = parameters.size();
+
 		Tensor* current = &loss_gradient;
-		for (int i = layers.size() - 1; i >= 0; i--) {
+		for (int i = static_cast<int>(count) - 1; i >= 0; i--) {
+			Profiler::Clock::time_point start;
+			if (profiling) start = Profiler::now();
+
 			layers[i]->backward(*current);
+			current = layers[i]->getInputGradient();
 
-			if (layers[i]->getWeightGradient() != nullptr) {
-				optimizer->updateWeights(layers[i]->weights, *layers[i]->getWeightGradient());
-			}
-			if (layers[i]->getBiasGradient() != nullptr) {
-				optimizer->updateBiases(layers[i]->biases, *layers[i]->getBiasGradient());
+			if (profiling) profiler.backward(i, *layers[i], start);
+
+			if (update_stream && bucket_end - parameter_offsets[i] >= GRADIENT_BUCKET) {
+				update_stream->submit(parameter_offsets[i], bucket_end);
+				bucket_end = parameter_offsets[i];
 			}
+		}
 
-			current = layers[i]->getInputGradient();
+		// nothing is left to overlap with the last bucket
+		if (update_stream && bucket_end) update_stream->finish(0, bucket_end);
+	}
+
+	// Forward, loss and backward of one batch, returns the mean loss. When the loss fuses the
+	// softmax of a final SOFTMAX_CEL layer, that layer is skipped both ways: the loss reads the
+	// layer's input, the logits, and writes the gradient to the layer's input gradient, which is
+	// what its backward would have passed on.
+	float trainStep(Tensor& input, const Tensor& labels, UpdateStream* update_stream = nullptr) {
+		if (!fusesSoftmaxLoss()) {
+			Tensor* predictions = predict(&input);
+
+			Tensor loss_gradient = loss_function->backward(labels, *predictions);
+			float loss = loss_function->compute(labels, *predictions);
+			backward(loss_gradient, layers.size(), update_stream);
+			return loss;
 		}
+
+		const size_t last = layers.size() - 1;
+		forward(&input, last);
+
+		Layer& softmax = *layers[last];
+		float loss = loss_function->computeFromLogits(labels, *softmax.getInput(), *softmax.getInputGradient());
+		backward(*softmax.getInputGradient(), last, update_stream);
+		return loss;
+	}
+
+	bool fusesSoftmaxLoss() const {
+		return loss_function->fusesSoftmax() &&
+			dynamic_cast<const ActivationLayer*>(layers.back()) &&
+			layers.back()->getActivationFunction() == ActivationFunctions::TYPES::SOFTMAX_CEL;
 	}
 	
-	void train_epoch(const Tensor& data, const Tensor& labels, size_t batch_size) {
-		size_t num_batches = data.getShape()[0] / batch_size;
-		linkLayers(batch_size);
+	void train_epoch(BatchPipeline& pipeline) {
+		const size_t batch_size = pipeline.batchSize();
+		const size_t count = std::min(workers, batch_size);
 
-		std::vector<size_t> bi_shape = data.getShape(), bl_shape = labels.getShape();
-		bi_shape[0] = bl_shape[0] = batch_size;
+		if (count > 1) {
+			if (replicas.size() != count - 1) buildReplicas(count - 1);
+			for (size_t t = 0; t < count; t++) worker(t).linkLayers(shardRows(batch_size, count, t));
+		}
+		else {
+			linkLayers(batch_size);
+		}
 
-		batch_input = Tensor(bi_shape);
-		batch_labels = Tensor(bl_shape);
+		const size_t batches = pipeline.batchesPerEpoch();
 
-		for (size_t i = 0; i < num_batches; i++) {
-			setBatch(batch_input, data, i, batch_size);
+		for (size_t i = 0; i < batches; i++) {
+			BatchPipeline::Batch& batch = pipeline.acquire();
+			float loss;
 
-			Tensor* predictions = predict(&batch_input);
-			setBatch(batch_labels, labels, i, batch_size);
+			// the last micro-batch of a step updates, earlier ones of the same step were accumulated
+			const bool update = (i + 1) % accumulation_steps == 0 || i + 1 == batches;
+			const bool accumulated = i % accumulation_steps != 0;
+
+			if (update) {
+				stream->begin(optimizer, parameters.data(), parameters.gradientData(),
+							  accumulated ? parameters.accumulatedData() : nullptr, parameters.size());
+			}
+
+			if (count > 1) {
+				loss = trainShards(batch, count);
+				if (update) stream->finish(0, parameters.size());
+			}
+			else {
+				loss = trainStep(batch.input, batch.labels, update ? stream.get() : nullptr);
+			}
+
+			std::cout << "Error from batch " << i << ": " << loss << std::endl;
+
+			// the next forward reads the updated parameters
+			if (update) {
+				stream->wait();
+				refreshHalfWeights();
+			}
+			else parameters.accumulate(!accumulated);
+
+			pipeline.release();
+		}
+	}
+
+	// One data-parallel training step: worker t runs forward and backward on the t-th shard of the
+	// batch, then the gradient arenas are summed into this network's. The sum runs over chunks of
+	// the arena in parallel, each chunk reduced by a pairwise tree over the workers. Loss gradients
+	// are sums over samples, so the shards' gradients add up to the gradient of the whole batch.
+	// Returns the mean loss of the batch.
+	float trainShards(BatchPipeline::Batch& batch, size_t count) {
+		const size_t rows = batch.input.getShape()[0];
+		const size_t size = parameters.size();
+		const size_t chunks = (size + REDUCE_CHUNK - 1) / REDUCE_CHUNK;
+		double loss = 0.0;
+
+#pragma omp parallel num_threads(count)
+		{
+#pragma omp for schedule(static, 1) reduction(+:loss)
+			for (size_t t = 0; t < count; t++) {
+				const size_t first = shardStart(rows, count, t), shard_rows = shardRows(rows, count, t);
+				Tensor input = batch.input.rows(first, shard_rows);
+				Tensor labels = batch.labels.rows(first, shard_rows);
+
+				loss += worker(t).trainStep(input, labels) * shard_rows;
+			}
 
-			Tensor loss_gradient = loss_function->backward(batch_labels, *predictions);
-			std::cout << "Error from batch " << i << ": " << loss_function->compute(batch_labels, *predictions) << std::endl;
-			backward(loss_gradient);
+#pragma omp for
+			for (size_t c = 0; c < chunks; c++) {
+				const size_t begin = c * REDUCE_CHUNK, end = std::min(size, begin + REDUCE_CHUNK);
+
+				for (size_t stride = 1; stride < count; stride *= 2) {
+					for (size_t t = 0; t + stride < count; t += 2 * stride) {
+						float* sum = worker(t).parameters.gradientData();
+						const float* other = worker(t + stride).parameters.gradientData();
+						for (size_t i = begin; i < end; i++) sum[i] += other[i];
+					}
+				}
+			}
 		}
+
+		return static_cast<float>(loss / rows);
+	}
+
+	// worker 0 is this network, the others its replicas
+	Network& worker(size_t t) {
+		return t ? *replicas[t - 1] : *this;
+	}
+
+	// shard t of count over rows, the first rows % count shards take one extra row
+	static size_t shardRows(size_t rows, size_t count, size_t t) {
+		return rows / count + (t < rows % count);
+	}
+
+	static size_t shardStart(size_t rows, size_t count, size_t t) {
+		return t * (rows / count) + std::min(t, rows % count);
 	}
 
-	void setBatch(Tensor& batch_tensor, const Tensor& data, size_t batch, size_t batch_size) {
-		size_t start_idx = batch * batch_size * data.getStrides()[0];
-		size_t end_idx = (batch + 1) * batch_size * data.getStrides()[0];
+	// Copies of the layer stack for data-parallel training, rebuilt through the model file layer
+	// factory. Their weights and biases are bound to this network's parameter arena, so every
+	// optimizer step reaches them, while gradients and activations are their own.
+	void buildReplicas(size_t count) {
+		clearReplicas();
+
+		for (size_t r = 0; r < count; r++) {
+			std::unique_ptr<Network> replica(new Network());
+
+			for (Layer* layer : layers) {
+				Layer* copy = ModelFile::createLayer(layer->getType(), layer->getActivationFunction(), layer->getHyperparameters());
+				replica_layers.emplace_back(copy);
+
+				if (!layer->weights.data.empty()) {
+					copy->setParameters(Tensor::bind(layer->weights.getShape(), layer->weights.data.data()),
+										Tensor::bind(layer->biases.getShape(), layer->biases.data.data()));
+				}
+
+				// keep the convolution algorithm this network runs
+				if (const ConvLayer* conv = dynamic_cast<const ConvLayer*>(layer)) {
+					static_cast<ConvLayer*>(copy)->setAlgorithm(conv->getAlgorithm());
+				}
+
+				replica->add(copy);
+			}
+
+			replica->input_shape = input_shape;
+			replica->loss_function = loss_function;
+			replica->precision = precision;
+			replica->initializeLayers();
+			replica->registerParameters();
+			replica->parameters.allocateGradients();
+
+			replicas.push_back(std::move(replica));
+		}
+	}
+
+	void clearReplicas() {
+		replicas.clear();
+		replica_layers.clear();
+	}
+
+	// registers every weight and bias with its gradient in the parameter arena, in layer order
+	void registerParameters() {
+		parameters.clear();
+		parameter_offsets.clear();
+
+		for (Layer* layer : layers) {
+			parameter_offsets.push_back(parameters.size());
+			if (layer->getWeightGradient()) parameters.add(layer->weights, *layer->getWeightGradient());
+			if (layer->getBiasGradient()) parameters.add(layer->biases, *layer->getBiasGradient());
+		}
+	}
+
+	static float absMax(const Tensor& tensor) {
+		float range = 0.0f;
+		for (float v : tensor.data) range = std::max(range, std::fabs(v));
+		return range;
+	}
+
+	// Adds the number of rows whose labelled class ranks first, and within the top k, to correct
+	// and correct_k. Labels are one-hot rows or sparse class indices. Ties rank the lower class
+	// index first, like an argmax.
+	static void countCorrect(const Tensor& predictions, const Tensor& labels, size_t top_k,
+							 size_t& correct, size_t& correct_k)
+	{
+		const size_t rows = predictions.getShape()[0];
+		const size_t classes = predictions.data.size() / rows;
+		const bool sparse = labels.data.size() == rows && classes > 1;
+		size_t top_1 = 0, top_n = 0;
+
+#pragma omp parallel for reduction(+:top_1, top_n)
+		for (size_t r = 0; r < rows; r++) {
+			const float* p = predictions.data.data() + r * classes;
+			const float* l = labels.data.data() + r * classes;
+
+			// a sparse label outside the classes counts as a miss
+			if (sparse && !(labels.data[r] >= 0.0f && labels.data[r] < classes)) continue;
+
+			const size_t label = sparse ? static_cast<size_t>(labels.data[r]) : std::max_element(l, l + classes) - l;
+
+			size_t rank = 0;
+			for (size_t j = 0; j < classes; j++) {
+				rank += p[j] > p[label] || (p[j] == p[label] && j < label);
+			}
 
-		if (end_idx > data.data.size()) {
-			throw std::out_of_range("batch out of range");
+			top_1 += rank == 0;
+			top_n += rank < top_k;
 		}
 
-		std::copy(data.data.begin() + start_idx,
-			data.data.begin() + end_idx,
-			batch_tensor.data.begin());
+		correct += top_1;
+		correct_k += top_n;
 	}
 
 };
\ No newline at end of file
@@ -17,6 +17,25 @@ public:
         updateWeights(biases, gradients);
     }
 
+    // Updates all n parameters of a network in one call. parameters and gradients are the flat
+    // buffers of a ParameterArena.
+    void step(float* parameters, const float* gradients, size_t n) {
+        beginStep(n);
+        stepRange(parameters, gradients, 0, n);
+    }
+
+    // A step can also be applied piecewise, so ranges of the arena are updated as soon as their
+    // gradients are ready: beginStep once per training step for an arena of n floats, then
+    // stepRange over disjoint ranges covering it, in any order.
+    virtual void beginStep(size_t) {}
+
+    // Updates [begin, end) of the arena, parameters and gradients point at the start of the arena
+    virtual void stepRange(float* parameters, const float* gradients, size_t begin, size_t end) {
+        Tensor p = Tensor::bind({ end - begin }, parameters + begin);
+        Tensor g = Tensor::bind({ end - begin }, const_cast<float*>(gradients) + begin);
+        updateWeights(p, g);
+    }
+
     virtual void setLearningRate(float lr) {
         learning_rate = lr;
     }
@@ -0,0 +1,45 @@
+#pragma once
+
+#ifdef _OPENMP
+#include <omp.h>
+#endif
+
+// Thin wrapper over the OpenMP runtime so kernels still build when OpenMP is disabled.
+class Parallel {
+public:
+	// threads a parallel region started here would get, 1 once nested regions are serialized
+	static int maxThreads() {
+#ifdef _OPENMP
+		if (omp_get_active_level() >= omp_get_max_active_levels()) return 1;
+		return omp_get_max_threads();
+#else
+		return 1;
+#endif
+	}
+
+	// threads for the parallel regions the calling thread starts from now on
+	static void setThreads(int threads) {
+#ifdef _OPENMP
+		omp_set_num_threads(threads);
+#else
+		(void)threads;
+#endif
+	}
+
+	static int threadId() {
+#ifdef _OPENMP
+		return omp_get_thread_num();
+#else
+		return 0;
+#endif
+	}
+
+	// true when called from inside a parallel region, kernels then run serially
+	static bool inParallel() {
+#ifdef _OPENMP
+		return omp_in_parallel() != 0;
+#else
+		return false;
+#endif
+	}
+};
\ No newline at end of file
@@ -0,0 +1,97 @@
+#pragma once
+
+#include "Tensor.hpp"
+
+// Holds every trainable parameter of a network, and its gradient, in one contiguous buffer so
+// the optimizer can update all of them with a single kernel per step. Registered tensors are
+// bound to their slice of the arena once allocate is called.
+class ParameterArena {
+public:
+	struct Segment {
+		size_t offset;
+		size_t size;
+	};
+
+private:
+	// segments start on 16 float (64 byte) boundaries
+	static const size_t ALIGNMENT = 16;
+
+	std::vector<Tensor*> parameter_tensors;
+	std::vector<Tensor*> gradient_tensors;
+	std::vector<Segment> segments;
+
+	TensorBuffer parameters;
+	TensorBuffer gradients;
+	size_t total = 0;
+
+	// sum of the gradients of earlier micro-batches, allocated by the first accumulate
+	TensorBuffer accumulated;
+
+public:
+	void clear() {
+		parameter_tensors.clear();
+		gradient_tensors.clear();
+		segments.clear();
+		total = 0;
+	}
+
+	void add(Tensor& parameter, Tensor& gradient) {
+		if (parameter.data.size() != gradient.data.size()) {
+			throw std::invalid_argument("Parameter and gradient sizes do not match.");
+		}
+
+		parameter_tensors.push_back(&parameter);
+		gradient_tensors.push_back(&gradient);
+		segments.push_back({ total, parameter.data.size() });
+
+		total += (parameter.data.size() + ALIGNMENT - 1) / ALIGNMENT * ALIGNMENT;
+	}
+
+	// Copies the current values into the arena and binds every registered tensor to it
+	void allocate() {
+		TensorBuffer new_parameters(total, 0.0f);
+		TensorBuffer new_gradients(total, 0.0f);
+
+		for (size_t i = 0; i < segments.size(); i++) {
+			std::copy(parameter_tensors[i]->data.begin(), parameter_tensors[i]->data.end(), new_parameters.begin() + segments[i].offset);
+			std::copy(gradient_tensors[i]->data.begin(), gradient_tensors[i]->data.end(), new_gradients.begin() + segments[i].offset);
+
+			parameter_tensors[i]->bind(new_parameters.data() + segments[i].offset);
+			gradient_tensors[i]->bind(new_gradients.data() + segments[i].offset);
+		}
+
+		// tensors may still point at a previous arena until they are rebound above
+		parameters = std::move(new_parameters);
+		gradients = std::move(new_gradients);
+	}
+
+	// Binds only the gradients to a new arena, parameters keep their current storage. Used by
+	// data-parallel replicas, which read the parameters of the network they copy in place.
+	void allocateGradients() {
+		TensorBuffer new_gradients(total, 0.0f);
+
+		for (size_t i = 0; i < segments.size(); i++) {
+			gradient_tensors[i]->bind(new_gradients.data() + segments[i].offset);
+		}
+
+		parameters = TensorBuffer();
+		gradients = std::move(new_gradients);
+	}
+
+	// Adds the current gradients to the accumulation buffer, first starts a new sum
+	void accumulate(bool first) {
+		accumulated.resize(total);
+
+#pragma omp parallel for if(total >= Tensor::PARALLEL_THRESHOLD)
+		for (size_t i = 0; i < total; i++) {
+			accumulated[i] = first ? gradients[i] : accumulated[i] + gradients[i];
+		}
+	}
+
+	float* data() { return parameters.data(); }
+	float* gradientData() { return gradients.data(); }
+	const float* accumulatedData() const { return accumulated.data(); }
+	size_t size() const { return total; }
+
+	const std::vector<Segment>& getSegments() const { return segments; }
+};
@@ -13,6 +13,14 @@ public:
     PoolLayer(size_t window_size, size_t stride = 1, ActivationFunctions::TYPES _ac = ActivationFunctions::TYPES::NONE)
         : Layer(_ac), window_size(window_size), stride(stride) {}
 
+    const char* getType() const override {
+        return "Pool";
+    }
+
+    std::vector<double> getHyperparameters() const override {
+        return { double(window_size), double(stride) };
+    }
+
     void initialize(std::vector<size_t> is) override {
         input_shape = is;
 
@@ -23,19 +31,83 @@ public:
     }
 
     void initOutput(size_t batches) override {
-        if (!output_shape.size()) {
-            throw std::exception("Layer must be intialized prior to setting the number of batches");
-        }
+        Layer::initOutput(batches);
+        // only backward reads the argmax positions
+        max_indices = inference ? Tensor() : Tensor(output_shape, -1);
+    }
+
+    bool supportsLayout(Layout::TYPES _layout) const override {
+        return _layout == Layout::NCHW || Layout::isBlocked(_layout);
+    }
 
-        input_shape[0] = batches;
-        output_shape[0] = batches;
-        output = new Tensor(output_shape);
+    // one comparison per window element, backward scatters through the saved argmax positions
+    Cost forwardCost() const override {
+        const double compares = elements(output_shape) * window_size * window_size;
+        return { compares, (elements(input_shape) + 2 * elements(output_shape)) * sizeof(float) };
+    }
 
-        input_gradient = new Tensor(input_shape);
-        max_indices = Tensor(output_shape, -1);
+    Cost backwardCost() const override {
+        return { elements(output_shape), (2 * elements(output_shape) + elements(input_shape)) * sizeof(float) };
     }
 
     void forward() override {
+        if (layout == Layout::NCHW8C) forwardBlocked<8>();
+        else if (layout == Layout::NCHW16C) forwardBlocked<16>();
+        else forwardNCHW();
+    }
+
+    void backward(const Tensor& gradOutput) override {
+        input_gradient->zero();
+
+        for (size_t b = 0; b < output_shape[0]; b++) {
+            for (size_t c = 0; c < output_shape[1]; c++) {
+                for (size_t h = 0; h < output_shape[2]; h++) {
+                    for (size_t w = 0; w < output_shape[3]; w++) {
+                        size_t flat_index = max_indices({ b, c, h, w });
+                        size_t input_h = flat_index / input_shape[3];
+                        size_t input_w = flat_index % input_shape[3];
+                        (*input_gradient)(b, c, input_h, input_w) += gradOutput(b, c, h, w);
+                    }
+                }
+            }
+        }
+    }
+
+private:
+    // Blocked layouts (inference only): the max runs over B contiguous channels at once
+    template <size_t B>
+    void forwardBlocked() {
+        const size_t blocks = (input_shape[1] + B - 1) / B;
+        const size_t H = input_shape[2], W = input_shape[3];
+        const size_t OH = output_shape[2], OW = output_shape[3];
+        const float* in = input->data.data();
+        float* out = output->data.data();
+
+#pragma omp parallel for collapse(2)
+        for (size_t n = 0; n < input_shape[0]; n++) {
+            for (size_t cb = 0; cb < blocks; cb++) {
+                const float* plane = in + (n * blocks + cb) * H * W * B;
+
+                for (size_t h = 0; h < OH; h++) {
+                    for (size_t w = 0; w < OW; w++) {
+                        float mx[B];
+                        std::fill(mx, mx + B, -FLT_MAX);
+
+                        for (size_t y = h * stride; y < std::min(h * stride + window_size, H); y++) {
+                            for (size_t x = w * stride; x < std::min(w * stride + window_size, W); x++) {
+                                const float* v = plane + (y * W + x) * B;
+                                for (size_t i = 0; i < B; i++) mx[i] = std::max(mx[i], v[i]);
+                            }
+                        }
+
+                        std::copy(mx, mx + B, out + (((n * blocks + cb) * OH + h) * OW + w) * B);
+                    }
+                }
+            }
+        }
+    }
+
+    void forwardNCHW() {
         for (size_t b = 0; b < input_shape[0]; b++) {
             for (size_t c = 0; c < input_shape[1]; c++) {
                 for (size_t h = 0; h < output_shape[2]; h++) {
@@ -61,26 +133,11 @@ public:
                             }
                         }
 
-                        max_indices(b, c, h, w) = max_index;
+                        if (!inference) max_indices(b, c, h, w) = max_index;
                         (*output)(b, c, h, w) = mx;
                     }
                 }
             }
         }
     }
-
-    void backward(const Tensor& gradOutput) override {
-        for (size_t b = 0; b < output_shape[0]; b++) {
-            for (size_t c = 0; c < output_shape[1]; c++) {
-                for (size_t h = 0; h < output_shape[2]; h++) {
-                    for (size_t w = 0; w < output_shape[3]; w++) {
-                        size_t flat_index = max_indices({ b, c, h, w });
-                        size_t input_h = flat_index / input_shape[3];
-                        size_t input_w = flat_index % input_shape[3];
-                        (*input_gradient)(b, c, input_h, input_w) += gradOutput(b, c, h, w);
-                    }
-                }
-            }
-        }
-    }
 };
@@ -0,0 +1,250 @@
+#pragma once
+
+#include "Parallel.hpp"
+#include <cstdint>
+#include <cstring>
+#include <cmath>
+#include <algorithm>
+
+#if defined(__AVX512F__) || defined(__AVX2__) || defined(__F16C__)
+#include <immintrin.h>
+#endif
+
+// 16 bit storage formats, as raw bits. Nothing computes in them: kernels convert to float as they
+// load and accumulate in fp32. bfloat16 keeps the float exponent and 8 bits of mantissa, float16
+// (IEEE half) 5 bits of exponent and 11 of mantissa, finite up to 65504.
+struct bfloat16 {
+	uint16_t bits;
+};
+
+struct float16 {
+	uint16_t bits;
+};
+
+// Storage precisions and the conversions between them. Float to 16 bits rounds to nearest even,
+// NaN stays NaN. The array conversions use AVX512-BF16 or F16C instructions when the build
+// targets them, the AVX-512 / AVX2 integer sequences otherwise. Every path gives the same bits,
+// except that AVX512-BF16 flushes float subnormals to zero.
+class Precision {
+public:
+	enum TYPES {
+		FLOAT32,
+		BFLOAT16,
+		FLOAT16
+	};
+
+	// elements per parallel task of the array conversions
+	static const size_t BLOCK = 1 << 15;
+
+	static size_t bytes(TYPES type) {
+		return type == FLOAT32 ? 4 : 2;
+	}
+
+	static float toFloat(float v) {
+		return v;
+	}
+
+	static float toFloat(bfloat16 v) {
+		return fromBits(static_cast<uint32_t>(v.bits) << 16);
+	}
+
+	static float toFloat(float16 v) {
+#if defined(__F16C__)
+		return _cvtsh_ss(v.bits);
+#else
+		const uint32_t sign = static_cast<uint32_t>(v.bits & 0x8000) << 16;
+		const uint32_t exponent = (v.bits >> 10) & 0x1F;
+		const uint32_t mantissa = v.bits & 0x3FF;
+
+		// subnormal halves are mantissa * 2^-24, exactly representable as floats
+		if (exponent == 0) {
+			const float value = std::ldexp(static_cast<float>(mantissa), -24);
+			return sign ? -value : value;
+		}
+		if (exponent == 31) return fromBits(sign | 0x7F800000 | (mantissa << 13));
+
+		return fromBits(sign | ((exponent + 112) << 23) | (mantissa << 13));
+#endif
+	}
+
+	static void store(float v, float& out) {
+		out = v;
+	}
+
+	static void store(float v, bfloat16& out) {
+		const uint32_t x = toBits(v);
+
+		if (std::isnan(v)) {
+			out.bits = static_cast<uint16_t>((x >> 16) | 0x40);
+			return;
+		}
+
+		out.bits = static_cast<uint16_t>((x + 0x7FFF + ((x >> 16) & 1)) >> 16);
+	}
+
+	static void store(float v, float16& out) {
+		uint32_t x = toBits(v);
+		const uint16_t sign = static_cast<uint16_t>((x >> 16) & 0x8000);
+		x &= 0x7FFFFFFF;
+
+		// infinity, NaN (quieted, keeping the top of its payload like F16C), then everything
+		// rounding to 65520 or more overflows
+		if (x >= 0x7F800000) {
+			out.bits = sign | (x > 0x7F800000 ? 0x7E00 | ((x >> 13) & 0x3FF) : 0x7C00);
+			return;
+		}
+		if (x >= 0x477FF000) {
+			out.bits = sign | 0x7C00;
+			return;
+		}
+
+		// below 2^-14 the half is subnormal, a multiple of 2^-24
+		if (x < 0x38800000) {
+			out.bits = sign | static_cast<uint16_t>(std::nearbyint(std::ldexp(fromBits(x), 24)));
+			return;
+		}
+
+		// rebias the exponent from 127 to 15 and round the mantissa from 23 to 10 bits
+		x -= 112u << 23;
+		x += 0xFFF + ((x >> 13) & 1);
+		out.bits = sign | static_cast<uint16_t>(x >> 13);
+	}
+
+	static void convert(const float* in, float* out, size_t n) {
+		std::memcpy(out, in, n * sizeof(float));
+	}
+
+	static void convert(const float* in, bfloat16* out, size_t n) {
+		map(n, [in, out](size_t begin, size_t end) { toBFloat16(in + begin, out + begin, end - begin); });
+	}
+
+	static void convert(const float* in, float16* out, size_t n) {
+		map(n, [in, out](size_t begin, size_t end) { toFloat16(in + begin, out + begin, end - begin); });
+	}
+
+	static void convert(const bfloat16* in, float* out, size_t n) {
+		map(n, [in, out](size_t begin, size_t end) { fromBFloat16(in + begin, out + begin, end - begin); });
+	}
+
+	static void convert(const float16* in, float* out, size_t n) {
+		map(n, [in, out](size_t begin, size_t end) { fromFloat16(in + begin, out + begin, end - begin); });
+	}
+
+private:
+	static uint32_t toBits(float v) {
+		uint32_t bits;
+		std::memcpy(&bits, &v, sizeof(bits));
+		return bits;
+	}
+
+	static float fromBits(uint32_t bits) {
+		float v;
+		std::memcpy(&v, &bits, sizeof(v));
+		return v;
+	}
+
+	// runs kernel(begin, end) over blocks of n elements, in parallel when n is large
+	template <typename Kernel>
+	static void map(size_t n, Kernel kernel) {
+		const size_t blocks = (n + BLOCK - 1) / BLOCK;
+
+#pragma omp parallel for if(blocks > 1 && !Parallel::inParallel())
+		for (size_t b = 0; b < blocks; b++) {
+			kernel(b * BLOCK, std::min(n, (b + 1) * BLOCK));
+		}
+	}
+
+	static void toBFloat16(const float* in, bfloat16* out, size_t n) {
+		size_t i = 0;
+
+#if defined(__AVX512BF16__)
+		for (; i + 16 <= n; i += 16) {
+			const __m256bh h = _mm512_cvtneps_pbh(_mm512_loadu_ps(in + i));
+			_mm256_storeu_si256(reinterpret_cast<__m256i*>(out + i), (__m256i)h);
+		}
+#elif defined(__AVX512F__)
+		const __m512i bias = _mm512_set1_epi32(0x7FFF), one = _mm512_set1_epi32(1), quiet = _mm512_set1_epi32(0x40);
+		for (; i + 16 <= n; i += 16) {
+			const __m512 v = _mm512_loadu_ps(in + i);
+			const __m512i x = _mm512_castps_si512(v);
+			const __m512i high = _mm512_srli_epi32(x, 16);
+
+			__m512i r = _mm512_srli_epi32(_mm512_add_epi32(_mm512_add_epi32(x, bias), _mm512_and_si512(high, one)), 16);
+			r = _mm512_mask_blend_epi32(_mm512_cmp_ps_mask(v, v, _CMP_UNORD_Q), r, _mm512_or_si512(high, quiet));
+
+			_mm256_storeu_si256(reinterpret_cast<__m256i*>(out + i), _mm512_cvtepi32_epi16(r));
+		}
+#elif defined(__AVX2__)
+		const __m256i bias = _mm256_set1_epi32(0x7FFF), one = _mm256_set1_epi32(1), quiet = _mm256_set1_epi32(0x40);
+		for (; i + 16 <= n; i += 16) {
+			__m256i r[2];
+			for (size_t h = 0; h < 2; h++) {
+				const __m256 v = _mm256_loadu_ps(in + i + 8 * h);
+				const __m256i x = _mm256_castps_si256(v);
+				const __m256i high = _mm256_srli_epi32(x, 16);
+
+				r[h] = _mm256_srli_epi32(_mm256_add_epi32(_mm256_add_epi32(x, bias), _mm256_and_si256(high, one)), 16);
+				r[h] = _mm256_blendv_epi8(r[h], _mm256_or_si256(high, quiet), _mm256_castps_si256(_mm256_cmp_ps(v, v, _CMP_UNORD_Q)));
+			}
+
+			// packus interleaves the 128 bit lanes of both halves, the permute restores the order
+			const __m256i packed = _mm256_permute4x64_epi64(_mm256_packus_epi32(r[0], r[1]), 0xD8);
+			_mm256_storeu_si256(reinterpret_cast<__m256i*>(out + i), packed);
+		}
+#endif
+
+		for (; i < n; i++) store(in[i], out[i]);
+	}
+
+	static void fromBFloat16(const bfloat16* in, float* out, size_t n) {
+		size_t i = 0;
+
+#if defined(__AVX512F__)
+		for (; i + 16 <= n; i += 16) {
+			const __m512i x = _mm512_cvtepu16_epi32(_mm256_loadu_si256(reinterpret_cast<const __m256i*>(in + i)));
+			_mm512_storeu_ps(out + i, _mm512_castsi512_ps(_mm512_slli_epi32(x, 16)));
+		}
+#elif defined(__AVX2__)
+		for (; i + 8 <= n; i += 8) {
+			const __m256i x = _mm256_cvtepu16_epi32(_mm_loadu_si128(reinterpret_cast<const __m128i*>(in + i)));
+			_mm256_storeu_ps(out + i, _mm256_castsi256_ps(_mm256_slli_epi32(x, 16)));
+		}
+#endif
+
+		for (; i < n; i++) out[i] = toFloat(in[i]);
+	}
+
+	static void toFloat16(const float* in, float16* out, size_t n) {
+		size_t i = 0;
+
+#if defined(__AVX512F__)
+		for (; i + 16 <= n; i += 16) {
+			const __m256i h = _mm512_cvtps_ph(_mm512_loadu_ps(in + i), _MM_FROUND_TO_NEAREST_INT | _MM_FROUND_NO_EXC);
+			_mm256_storeu_si256(reinterpret_cast<__m256i*>(out + i), h);
+		}
+#elif defined(__F16C__)
+		for (; i + 8 <= n; i += 8) {
+			const __m128i h = _mm256_cvtps_ph(_mm256_loadu_ps(in + i), _MM_FROUND_TO_NEAREST_INT | _MM_FROUND_NO_EXC);
+			_mm_storeu_si128(reinterpret_cast<__m128i*>(out + i), h);
+		}
+#endif
+
+		for (; i < n; i++) store(in[i], out[i]);
+	}
+
+	static void fromFloat16(const float16* in, float* out, size_t n) {
+		size_t i = 0;
+
+#if defined(__AVX512F__)
+		for (; i + 16 <= n; i += 16) {
+			_mm512_storeu_ps(out + i, _mm512_cvtph_ps(_mm256_loadu_si256(reinterpret_cast<const __m256i*>(in + i))));
+		}
+#elif defined(__F16C__)
+		for (; i + 8 <= n; i += 8) {
+			_mm256_storeu_ps(out + i, _mm256_cvtph_ps(_mm_loadu_si128(reinterpret_cast<const __m128i*>(in + i))));
+		}
+#endif
+
+		for (; i < n; i++) out[i] = toFloat(in[i]);
+	}
+};
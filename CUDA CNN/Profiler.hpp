@@ -0,0 +1,131 @@
+#pragma once
+
+#include "Layer.hpp"
+#include <chrono>
+#include <string>
+#include <vector>
+#include <sstream>
+#include <iomanip>
+#include <algorithm>
+
+// Per-layer counters filled by Network::predict and backward while profiling is on: wall time
+// and calls of forward and backward, and the analytical FLOPs and bytes of those calls from
+// Layer::forwardCost and backwardCost, which give the achieved GFLOP/s and GB/s.
+class Profiler {
+public:
+	typedef std::chrono::steady_clock Clock;
+
+	struct Pass {
+		size_t calls = 0;
+		double seconds = 0.0;
+		double flops = 0.0;
+		double bytes = 0.0;
+
+		double gflops() const { return seconds > 0.0 ? flops / seconds * 1e-9 : 0.0; }
+		double gbytes() const { return seconds > 0.0 ? bytes / seconds * 1e-9 : 0.0; }
+	};
+
+	struct Entry {
+		std::string name;
+		Pass forward;
+		Pass backward;
+
+		double seconds() const { return forward.seconds + backward.seconds; }
+	};
+
+private:
+	std::vector<Entry> entries;
+
+public:
+	static Clock::time_point now() {
+		return Clock::now();
+	}
+
+	void reset() {
+		entries.clear();
+	}
+
+	// records a forward call of layer index that started at start
+	void forward(size_t index, const Layer& layer, Clock::time_point start) {
+		record(entry(index, layer).forward, layer.forwardCost(), start);
+	}
+
+	void backward(size_t index, const Layer& layer, Clock::time_point start) {
+		record(entry(index, layer).backward, layer.backwardCost(), start);
+	}
+
+	const std::vector<Entry>& getEntries() const {
+		return entries;
+	}
+
+	// Table of every layer, the most expensive first, with a total row
+	std::string report() const {
+		std::vector<const Entry*> sorted;
+		Entry total;
+		total.name = "total";
+
+		for (const Entry& e : entries) {
+			if (!e.forward.calls && !e.backward.calls) continue;
+			sorted.push_back(&e);
+			add(total.forward, e.forward);
+			add(total.backward, e.backward);
+		}
+
+		std::stable_sort(sorted.begin(), sorted.end(), [](const Entry* a, const Entry* b) { return a->seconds() > b->seconds(); });
+
+		std::ostringstream out;
+		out << std::fixed << std::left << std::setw(28) << "layer" << std::right
+			<< std::setw(7) << "%" << std::setw(8) << "calls" << std::setw(11) << "fwd ms" << std::setw(9) << "GFLOP/s" << std::setw(8) << "GB/s"
+			<< std::setw(8) << "calls" << std::setw(11) << "bwd ms" << std::setw(9) << "GFLOP/s" << std::setw(8) << "GB/s" << "\n";
+
+		for (const Entry* e : sorted) row(out, *e, total.seconds());
+		row(out, total, total.seconds());
+
+		return out.str();
+	}
+
+private:
+	Entry& entry(size_t index, const Layer& layer) {
+		if (index >= entries.size()) entries.resize(index + 1);
+
+		// named on first use, with the shape of the output without the batch
+		Entry& e = entries[index];
+		if (e.name.empty()) {
+			std::ostringstream name;
+			name << index << " " << layer.getType();
+
+			const std::vector<size_t> shape = layer.getOutputShape();
+			for (size_t d = 1; d < shape.size(); d++) name << (d == 1 ? " " : "x") << shape[d];
+			e.name = name.str();
+		}
+
+		return e;
+	}
+
+	static void record(Pass& pass, const Layer::Cost& cost, Clock::time_point start) {
+		pass.seconds += std::chrono::duration<double>(Clock::now() - start).count();
+		pass.calls++;
+		pass.flops += cost.flops;
+		pass.bytes += cost.bytes;
+	}
+
+	static void add(Pass& sum, const Pass& pass) {
+		sum.calls += pass.calls;
+		sum.seconds += pass.seconds;
+		sum.flops += pass.flops;
+		sum.bytes += pass.bytes;
+	}
+
+	static void row(std::ostringstream& out, const Entry& e, double total_seconds) {
+		const double share = total_seconds > 0.0 ? 100.0 * e.seconds() / total_seconds : 0.0;
+
+		out << std::left << std::setw(28) << e.name.substr(0, 27) << std::right << std::setprecision(1) << std::setw(7) << share;
+
+		for (const Pass* pass : { &e.forward, &e.backward }) {
+			out << std::setw(8) << pass->calls << std::setprecision(2) << std::setw(11) << pass->seconds * 1e3
+				<< std::setprecision(1) << std::setw(9) << pass->gflops() << std::setw(8) << pass->gbytes();
+		}
+
+		out << "\n";
+	}
+};
\ No newline at end of file
@@ -0,0 +1,43 @@
+#pragma once
+
+#include "Layer.hpp"
+
+// Converts activations between layouts. Network::compileForInference inserts these where a layer
+// running in a blocked layout meets one that only runs in NCHW.
+class ReorderLayer : public Layer {
+private:
+	Layout::TYPES from;
+	Layout::TYPES to;
+
+public:
+	ReorderLayer(Layout::TYPES from, Layout::TYPES to) : Layer(), from(from), to(to) {}
+
+	const char* getType() const override {
+		return "Reorder";
+	}
+
+	bool supportsLayout(Layout::TYPES _layout) const override {
+		return true;
+	}
+
+	Layout::TYPES getInputLayout() const override {
+		return from;
+	}
+
+	Layout::TYPES getOutputLayout() const override {
+		return to;
+	}
+
+	void initialize(std::vector<size_t> is) override {
+		input_shape = is;
+		output_shape = is;
+	}
+
+	void forward() override {
+		Layout::reorder(input->data.data(), from, output->data.data(), to, input_shape);
+	}
+
+	void backward(const Tensor& gradOutput) override {
+		Layout::reorder(gradOutput.data.data(), to, input_gradient->data.data(), from, input_shape);
+	}
+};
@@ -7,6 +7,13 @@ public:
 	SGD(float learning_rate = 0.01) : Optimizer(learning_rate) {};
 
 	void updateWeights(Tensor& weights, const Tensor& gradients) override {
-		weights -= gradients * learning_rate;
+		weights.axpy(-learning_rate, gradients);
 	};
+
+	void stepRange(float* parameters, const float* gradients, size_t begin, size_t end) override {
+#pragma omp parallel for if(end - begin >= Tensor::PARALLEL_THRESHOLD)
+		for (size_t i = begin; i < end; i++) {
+			parameters[i] -= learning_rate * gradients[i];
+		}
+	}
 };
\ No newline at end of file
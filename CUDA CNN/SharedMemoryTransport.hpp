@@ -0,0 +1,205 @@
+#pragma once
+
+#include "Transport.hpp"
+#include <atomic>
+#include <stdexcept>
+#include <string>
+#include <thread>
+#include <chrono>
+#include <cstdint>
+#include <cstring>
+#include <algorithm>
+
+#ifndef _WIN32
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+
+// Ring transport for processes on one host (POSIX only). All ranks map one named shared memory
+// segment holding a single-producer single-consumer byte ring per rank: rank r writes into ring
+// r and rank r + 1 reads it, so data moves with two memcpys and no system calls. The name must be
+// unique to the job, it is unlinked as soon as every rank has attached.
+class SharedMemoryTransport : public Transport {
+private:
+	static const size_t CACHE_LINE = 64;
+
+	struct Ring {
+		alignas(CACHE_LINE) std::atomic<uint64_t> written;
+		alignas(CACHE_LINE) std::atomic<uint64_t> read;
+	};
+
+	struct Header {
+		alignas(CACHE_LINE) std::atomic<uint64_t> attached;
+	};
+
+	size_t my_rank;
+	size_t ranks;
+	size_t capacity;
+	size_t length = 0;
+	char* base = nullptr;
+
+	// how long to wait for rank 0 to create the segment, and for every rank to attach
+	static const int ATTACH_TIMEOUT_MS = 60000;
+
+public:
+	// capacity is the size of each rank's ring in bytes, a power of two
+	SharedMemoryTransport(size_t _rank, size_t _size, const std::string& name, size_t _capacity = size_t(1) << 22)
+		: my_rank(_rank), ranks(_size), capacity(_capacity)
+	{
+#ifdef _WIN32
+		throw std::runtime_error("SharedMemoryTransport is only available on POSIX systems.");
+#else
+		if (my_rank >= ranks) {
+			throw std::invalid_argument("Rank must be smaller than the number of ranks.");
+		}
+		if (!capacity || (capacity & (capacity - 1))) {
+			throw std::invalid_argument("Ring capacity must be a power of two.");
+		}
+		static_assert(ATOMIC_LLONG_LOCK_FREE == 2, "shared memory rings need lock-free 64 bit atomics");
+
+		length = sizeof(Header) + ranks * (sizeof(Ring) + capacity);
+		const std::string path = "/" + name;
+		auto deadline = std::chrono::steady_clock::now() + std::chrono::milliseconds(ATTACH_TIMEOUT_MS);
+
+		// rank 0 creates and sizes the segment, a fresh segment is zero filled which is the
+		// empty state of every ring, the others wait until it is there at its full size
+		int fd;
+		if (my_rank == 0) {
+			fd = ::shm_open(path.c_str(), O_CREAT | O_EXCL | O_RDWR, 0600);
+			if (fd >= 0 && ::ftruncate(fd, length)) {
+				::close(fd);
+				fd = -1;
+			}
+		}
+		else {
+			while (true) {
+				fd = ::shm_open(path.c_str(), O_RDWR, 0600);
+				struct stat st;
+				if (fd >= 0 && !::fstat(fd, &st) && size_t(st.st_size) == length) break;
+				if (fd >= 0) ::close(fd);
+
+				if (std::chrono::steady_clock::now() > deadline) {
+					fd = -1;
+					break;
+				}
+				std::this_thread::sleep_for(std::chrono::milliseconds(10));
+			}
+		}
+
+		if (fd < 0) {
+			throw std::runtime_error("Failed to open shared memory segment " + path);
+		}
+
+		void* p = ::mmap(nullptr, length, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+		::close(fd);
+		if (p == MAP_FAILED) {
+			throw std::runtime_error("Failed to map shared memory segment " + path);
+		}
+		base = static_cast<char*>(p);
+
+		header().attached.fetch_add(1);
+
+		if (my_rank == 0) {
+			while (header().attached.load() < ranks) {
+				if (std::chrono::steady_clock::now() > deadline) {
+					::shm_unlink(path.c_str());
+					::munmap(base, length);
+					throw std::runtime_error("Timed out waiting for every rank to attach to " + path);
+				}
+				std::this_thread::sleep_for(std::chrono::milliseconds(1));
+			}
+
+			// the mappings keep the memory alive, the name is no longer needed
+			::shm_unlink(path.c_str());
+		}
+#endif
+	}
+
+	~SharedMemoryTransport() {
+#ifndef _WIN32
+		if (base) ::munmap(base, length);
+#endif
+	}
+
+	SharedMemoryTransport(const SharedMemoryTransport&) = delete;
+	SharedMemoryTransport& operator=(const SharedMemoryTransport&) = delete;
+
+	size_t rank() const override { return my_rank; }
+	size_t size() const override { return ranks; }
+
+	void sendRecv(const void* send, size_t send_bytes, void* recv, size_t recv_bytes) override {
+		const char* out = static_cast<const char*>(send);
+		char* in = static_cast<char*>(recv);
+
+		Ring& outgoing = ring(my_rank);
+		Ring& incoming = ring(previous());
+		char* outgoing_data = ringData(my_rank);
+		const char* incoming_data = ringData(previous());
+
+		size_t idle = 0;
+
+		while (send_bytes || recv_bytes) {
+			size_t moved = 0;
+
+			if (send_bytes) {
+				const uint64_t written = outgoing.written.load(std::memory_order_relaxed);
+				const uint64_t free = capacity - (written - outgoing.read.load(std::memory_order_acquire));
+				const size_t n = std::min<size_t>(send_bytes, free);
+
+				if (n) {
+					copyIn(outgoing_data, written, out, n);
+					outgoing.written.store(written + n, std::memory_order_release);
+					out += n;
+					send_bytes -= n;
+					moved += n;
+				}
+			}
+
+			if (recv_bytes) {
+				const uint64_t read = incoming.read.load(std::memory_order_relaxed);
+				const uint64_t available = incoming.written.load(std::memory_order_acquire) - read;
+				const size_t n = std::min<size_t>(recv_bytes, available);
+
+				if (n) {
+					copyOut(incoming_data, read, in, n);
+					incoming.read.store(read + n, std::memory_order_release);
+					in += n;
+					recv_bytes -= n;
+					moved += n;
+				}
+			}
+
+			// spin briefly while the neighbours catch up, then give the core away
+			idle = moved ? 0 : idle + 1;
+			if (idle > 1024) std::this_thread::yield();
+		}
+	}
+
+private:
+	Header& header() {
+		return *reinterpret_cast<Header*>(base);
+	}
+
+	Ring& ring(size_t r) {
+		return *reinterpret_cast<Ring*>(base + sizeof(Header) + r * sizeof(Ring));
+	}
+
+	char* ringData(size_t r) {
+		return base + sizeof(Header) + ranks * sizeof(Ring) + r * capacity;
+	}
+
+	// copies n bytes into the ring at stream position, wrapping at the end of the buffer
+	void copyIn(char* data, uint64_t position, const char* src, size_t n) const {
+		const size_t start = position & (capacity - 1), first = std::min(n, capacity - start);
+		std::memcpy(data + start, src, first);
+		std::memcpy(data, src + first, n - first);
+	}
+
+	void copyOut(const char* data, uint64_t position, char* dst, size_t n) const {
+		const size_t start = position & (capacity - 1), first = std::min(n, capacity - start);
+		std::memcpy(dst, data + start, first);
+		std::memcpy(dst + first, data, n - first);
+	}
+};
\ No newline at end of file
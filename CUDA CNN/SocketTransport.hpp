@@ -0,0 +1,215 @@
+#pragma once
+
+#include "Transport.hpp"
+#include <stdexcept>
+#include <string>
+#include <vector>
+#include <thread>
+#include <chrono>
+#include <cerrno>
+#include <cstring>
+
+#ifndef _WIN32
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <netdb.h>
+#include <poll.h>
+#include <unistd.h>
+#endif
+
+// Ring transport over stream sockets (POSIX only). Every rank listens on its own endpoint, accepts
+// the connection of the previous rank and connects to the next one. Endpoints are "host:port" for
+// TCP, which also works across nodes, or "unix:/path" for a Unix domain socket on one host.
+class SocketTransport : public Transport {
+private:
+	size_t my_rank;
+	size_t ranks;
+	int next_fd = -1;
+	int previous_fd = -1;
+
+	// how long to keep retrying the connection to the next rank while it starts up
+	static const int CONNECT_TIMEOUT_MS = 60000;
+
+public:
+	SocketTransport(size_t _rank, const std::vector<std::string>& endpoints)
+		: my_rank(_rank), ranks(endpoints.size())
+	{
+#ifdef _WIN32
+		throw std::runtime_error("SocketTransport is only available on POSIX systems.");
+#else
+		if (my_rank >= ranks) {
+			throw std::invalid_argument("Rank must be smaller than the number of endpoints.");
+		}
+		if (ranks == 1) return;
+
+		int listener = listenOn(endpoints[my_rank]);
+
+		// connect before accepting, every rank is listening by the time its neighbour connects
+		try {
+			next_fd = connectTo(endpoints[next()]);
+		}
+		catch (...) {
+			::close(listener);
+			throw;
+		}
+
+		previous_fd = ::accept(listener, nullptr, nullptr);
+		::close(listener);
+		if (isUnix(endpoints[my_rank])) ::unlink(endpoints[my_rank].c_str() + 5);
+
+		if (previous_fd < 0) {
+			::close(next_fd);
+			throw std::runtime_error("Failed to accept the connection of the previous rank.");
+		}
+#endif
+	}
+
+	~SocketTransport() {
+#ifndef _WIN32
+		if (next_fd >= 0) ::close(next_fd);
+		if (previous_fd >= 0) ::close(previous_fd);
+#endif
+	}
+
+	SocketTransport(const SocketTransport&) = delete;
+	SocketTransport& operator=(const SocketTransport&) = delete;
+
+	// Unix domain socket endpoints path_prefix0, path_prefix1, ... for size ranks on one host
+	static std::vector<std::string> localEndpoints(const std::string& path_prefix, size_t size) {
+		std::vector<std::string> endpoints;
+		for (size_t r = 0; r < size; r++) endpoints.push_back("unix:" + path_prefix + std::to_string(r));
+		return endpoints;
+	}
+
+	size_t rank() const override { return my_rank; }
+	size_t size() const override { return ranks; }
+
+	void sendRecv(const void* send, size_t send_bytes, void* recv, size_t recv_bytes) override {
+#ifndef _WIN32
+		const char* out = static_cast<const char*>(send);
+		char* in = static_cast<char*>(recv);
+
+		while (send_bytes || recv_bytes) {
+			pollfd fds[2];
+			nfds_t count = 0;
+			if (send_bytes) fds[count++] = { next_fd, POLLOUT, 0 };
+			if (recv_bytes) fds[count++] = { previous_fd, POLLIN, 0 };
+
+			if (::poll(fds, count, -1) < 0) {
+				if (errno == EINTR) continue;
+				throw std::runtime_error("poll failed on the ring sockets.");
+			}
+
+			for (nfds_t i = 0; i < count; i++) {
+				if (!fds[i].revents) continue;
+
+				if (fds[i].fd == next_fd && send_bytes) {
+					ssize_t n = ::send(next_fd, out, send_bytes, MSG_DONTWAIT | MSG_NOSIGNAL);
+					if (n < 0 && errno != EAGAIN && errno != EWOULDBLOCK && errno != EINTR) {
+						throw std::runtime_error("Lost the connection to the next rank.");
+					}
+					if (n > 0) { out += n; send_bytes -= n; }
+				}
+				else if (recv_bytes) {
+					ssize_t n = ::recv(previous_fd, in, recv_bytes, MSG_DONTWAIT);
+					if (n == 0 || (n < 0 && errno != EAGAIN && errno != EWOULDBLOCK && errno != EINTR)) {
+						throw std::runtime_error("Lost the connection to the previous rank.");
+					}
+					if (n > 0) { in += n; recv_bytes -= n; }
+				}
+			}
+		}
+#endif
+	}
+
+private:
+#ifndef _WIN32
+	static bool isUnix(const std::string& endpoint) {
+		return endpoint.compare(0, 5, "unix:") == 0;
+	}
+
+	// fills a sockaddr for the endpoint, returns its length
+	static socklen_t address(const std::string& endpoint, sockaddr_storage& storage, bool listening) {
+		std::memset(&storage, 0, sizeof(storage));
+
+		if (isUnix(endpoint)) {
+			sockaddr_un* addr = reinterpret_cast<sockaddr_un*>(&storage);
+			std::string path = endpoint.substr(5);
+			if (path.size() >= sizeof(addr->sun_path)) {
+				throw std::invalid_argument("Unix socket path is too long: " + path);
+			}
+
+			addr->sun_family = AF_UNIX;
+			std::memcpy(addr->sun_path, path.c_str(), path.size() + 1);
+			return sizeof(sockaddr_un);
+		}
+
+		size_t colon = endpoint.rfind(':');
+		if (colon == std::string::npos) {
+			throw std::invalid_argument("Endpoint must be host:port or unix:/path, got " + endpoint);
+		}
+
+		addrinfo hints = {};
+		hints.ai_family = AF_INET;
+		hints.ai_socktype = SOCK_STREAM;
+		addrinfo* result = nullptr;
+
+		// a listening rank binds every interface on its port
+		std::string host = listening ? "0.0.0.0" : endpoint.substr(0, colon);
+		if (::getaddrinfo(host.c_str(), endpoint.c_str() + colon + 1, &hints, &result) || !result) {
+			throw std::runtime_error("Failed to resolve " + endpoint);
+		}
+
+		socklen_t length = result->ai_addrlen;
+		std::memcpy(&storage, result->ai_addr, length);
+		::freeaddrinfo(result);
+		return length;
+	}
+
+	static int listenOn(const std::string& endpoint) {
+		sockaddr_storage storage;
+		socklen_t length = address(endpoint, storage, true);
+
+		int fd = ::socket(storage.ss_family, SOCK_STREAM, 0);
+		if (fd < 0) throw std::runtime_error("Failed to create a socket.");
+
+		int one = 1;
+		if (isUnix(endpoint)) ::unlink(endpoint.c_str() + 5);
+		else ::setsockopt(fd, SOL_SOCKET, SO_REUSEADDR, &one, sizeof(one));
+
+		if (::bind(fd, reinterpret_cast<sockaddr*>(&storage), length) || ::listen(fd, 1)) {
+			::close(fd);
+			throw std::runtime_error("Failed to listen on " + endpoint);
+		}
+
+		return fd;
+	}
+
+	static int connectTo(const std::string& endpoint) {
+		sockaddr_storage storage;
+		socklen_t length = address(endpoint, storage, false);
+
+		auto deadline = std::chrono::steady_clock::now() + std::chrono::milliseconds(CONNECT_TIMEOUT_MS);
+
+		while (true) {
+			int fd = ::socket(storage.ss_family, SOCK_STREAM, 0);
+			if (fd < 0) throw std::runtime_error("Failed to create a socket.");
+
+			if (!::connect(fd, reinterpret_cast<sockaddr*>(&storage), length)) {
+				// chunks of the ring are latency bound, do not wait to coalesce them
+				int one = 1;
+				if (!isUnix(endpoint)) ::setsockopt(fd, IPPROTO_TCP, TCP_NODELAY, &one, sizeof(one));
+				return fd;
+			}
+
+			::close(fd);
+			if (std::chrono::steady_clock::now() > deadline) {
+				throw std::runtime_error("Timed out connecting to " + endpoint);
+			}
+			std::this_thread::sleep_for(std::chrono::milliseconds(10));
+		}
+	}
+#endif
+};
\ No newline at end of file
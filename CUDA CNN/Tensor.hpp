@@ -5,13 +5,20 @@
 #include <numeric>
 #include <functional>
 #include <cmath>
+#include <string>
 #include <omp.h>
+#include "Gemm.hpp"
+#include "TensorBuffer.hpp"
+#include "Layout.hpp"
 
 class Tensor {
 private: 
 	std::vector<size_t> shape;
 	std::vector<size_t> strides;
 
+	// memory order of a 4-d tensor, the shape stays the logical { N, C, H, W }
+	Layout::TYPES layout = Layout::NCHW;
+
 	void computeStrides() {
 		strides.resize(shape.size());
 		size_t stride = 1;
@@ -37,8 +44,20 @@ private:
 		return idx;
 	}
 
+	void requireSameShape(const Tensor& other, const char* operation) const {
+		if (shape != other.shape) {
+			throw std::invalid_argument(std::string("Shape mismatch: Tensors must have the same shape for element-wise ") + operation);
+		}
+		if (layout != other.layout) {
+			throw std::invalid_argument(std::string("Layout mismatch: Tensors must have the same layout for element-wise ") + operation);
+		}
+	}
+
 public: 
-	std::vector<float> data;
+	// element-wise kernels below this size are not worth a parallel region
+	static const size_t PARALLEL_THRESHOLD = 1 << 15;
+
+	TensorBuffer data;
 
 	Tensor() = default;
 
@@ -47,6 +66,68 @@ public:
 		data.resize(std::accumulate(shape.begin(), shape.end(), 1, std::multiplies<>()), initial);
 	}
 
+	// Tensor stored in the given layout, blocked layouts allocate whole channel blocks
+	Tensor(const std::vector<size_t> shape, Layout::TYPES layout, float initial = 0.0f) : shape(shape), layout(layout) {
+		computeStrides();
+		data.resize(Layout::storageSize(shape, layout), initial);
+	}
+
+	// Tensor whose elements are left unset, for results that are written in full before being read
+	static Tensor uninitialized(const std::vector<size_t>& shape, Layout::TYPES layout = Layout::NCHW) {
+		Tensor result;
+		result.shape = shape;
+		result.layout = layout;
+		result.computeStrides();
+		result.data = TensorBuffer::uninitialized(Layout::storageSize(shape, layout));
+		return result;
+	}
+
+	// Non-owning tensor over external memory, which must outlive it. nullptr leaves it unbound
+	// until bind is called.
+	static Tensor bind(const std::vector<size_t>& shape, float* memory, Layout::TYPES layout = Layout::NCHW) {
+		Tensor result;
+		result.shape = shape;
+		result.layout = layout;
+		result.computeStrides();
+		result.data = TensorBuffer(memory, Layout::storageSize(shape, layout));
+		return result;
+	}
+
+	// Points the tensor at external memory holding the same number of elements
+	void bind(float* memory) {
+		data.bind(memory);
+	}
+
+	// Non-owning view of rows [first, first + count) of the first dimension, e.g. a batch of a
+	// dataset. It shares this tensor's memory, which must outlive it, and must not be written
+	// through when taken from a const tensor.
+	Tensor rows(size_t first, size_t count) const {
+		if (shape.empty() || first + count > shape[0]) {
+			throw std::out_of_range("Rows out of range.");
+		}
+
+		std::vector<size_t> view_shape = shape;
+		view_shape[0] = count;
+		const size_t row_size = shape[0] ? data.size() / shape[0] : 0;
+
+		return bind(view_shape, const_cast<float*>(data.data()) + first * row_size, layout);
+	}
+
+	// Non-owning view of the same memory under another shape with as many elements, with the
+	// same lifetime and constness rules as rows
+	Tensor view(const std::vector<size_t>& new_shape) const {
+		size_t size = std::accumulate(new_shape.begin(), new_shape.end(), size_t(1), std::multiplies<>());
+		if (size != data.size()) {
+			throw std::invalid_argument("New shape must have the same total size as the old shape");
+		}
+		if (layout != Layout::NCHW && new_shape != shape) {
+			throw std::invalid_argument("Only NCHW tensors can be viewed in another shape.");
+		}
+
+		return bind(new_shape, const_cast<float*>(data.data()), layout);
+	}
+
+	// element access for NCHW tensors, other layouts go through Layout::offset
 	inline float& operator()(size_t b, size_t c, size_t h, size_t w) {
 		return data[b * strides[0] + c * strides[1] + h * strides[2] + w * strides[3]];
 	}
@@ -68,7 +149,7 @@ public:
 			throw std::invalid_argument("Shape mismatch: Tensors must have the same shape for element-wise multiplication");
 		}
 
-		Tensor result(shape);
+		Tensor result = uninitialized(shape, layout);
 
 #pragma omp parallel for
 		for (size_t i = 0; i < data.size(); i++) {
@@ -83,7 +164,7 @@ public:
 			throw std::invalid_argument("Shape mismatch: Tensors must have the same shape for element-wise multiplication");
 		}
 
-		Tensor result(shape);
+		Tensor result = uninitialized(shape, layout);
 
 		for (size_t i = 0; i < data.size(); i++) {
 			result.data[i] = data[i] / other.data[i];
@@ -93,7 +174,7 @@ public:
 	}
 
 	Tensor operator*(float other) const {
-		Tensor result(shape);
+		Tensor result = uninitialized(shape, layout);
 
 		for (size_t i = 0; i < data.size(); i++) {
 			result.data[i] = data[i] * other;
@@ -103,7 +184,7 @@ public:
 	}
 
 	Tensor operator/(float other) const {
-		Tensor result(shape);
+		Tensor result = uninitialized(shape, layout);
 
 		for (size_t i = 0; i < data.size(); i++) {
 			result.data[i] = data[i] / other;
@@ -113,7 +194,7 @@ public:
 	}
 
 	Tensor operator+(float other) const {
-		Tensor result(shape);
+		Tensor result = uninitialized(shape, layout);
 
 		for (size_t i = 0; i < data.size(); i++) {
 			result.data[i] = data[i] + other;
@@ -123,7 +204,7 @@ public:
 	}
 
 	Tensor operator+(const Tensor& other) const {
-		Tensor result(shape);
+		Tensor result = uninitialized(shape, layout);
 
 		for (size_t i = 0; i < data.size(); i++) {
 			result.data[i] = data[i] + other.data[i];
@@ -132,20 +213,122 @@ public:
 		return result;
 	}
 
-	void operator-=(const Tensor& other) {
-		if (shape != other.getShape()) {
-			throw std::invalid_argument("Shape mismatch: Tensors must have the same shape for element-wise subtraction");
+	// In-place operators: a single parallel pass over the data with no temporaries
+
+	Tensor& operator+=(const Tensor& other) {
+		requireSameShape(other, "addition");
+
+#pragma omp parallel for if(data.size() >= PARALLEL_THRESHOLD)
+		for (size_t i = 0; i < data.size(); i++) {
+			data[i] += other.data[i];
 		}
 
+		return *this;
+	}
+
+	Tensor& operator-=(const Tensor& other) {
+		requireSameShape(other, "subtraction");
+
+#pragma omp parallel for if(data.size() >= PARALLEL_THRESHOLD)
 		for (size_t i = 0; i < data.size(); i++) {
 			data[i] -= other.data[i];
 		}
+
+		return *this;
+	}
+
+	Tensor& operator*=(const Tensor& other) {
+		requireSameShape(other, "multiplication");
+
+#pragma omp parallel for if(data.size() >= PARALLEL_THRESHOLD)
+		for (size_t i = 0; i < data.size(); i++) {
+			data[i] *= other.data[i];
+		}
+
+		return *this;
+	}
+
+	Tensor& operator/=(const Tensor& other) {
+		requireSameShape(other, "division");
+
+#pragma omp parallel for if(data.size() >= PARALLEL_THRESHOLD)
+		for (size_t i = 0; i < data.size(); i++) {
+			data[i] /= other.data[i];
+		}
+
+		return *this;
+	}
+
+	Tensor& operator+=(float other) {
+#pragma omp parallel for if(data.size() >= PARALLEL_THRESHOLD)
+		for (size_t i = 0; i < data.size(); i++) {
+			data[i] += other;
+		}
+
+		return *this;
 	}
 
-	void operator/=(float other) {
+	Tensor& operator*=(float other) {
+#pragma omp parallel for if(data.size() >= PARALLEL_THRESHOLD)
 		for (size_t i = 0; i < data.size(); i++) {
-			data[i] /= other;
+			data[i] *= other;
 		}
+
+		return *this;
+	}
+
+	Tensor& operator/=(float other) {
+		return *this *= 1.0f / other;
+	}
+
+	// this += alpha * x
+	Tensor& axpy(float alpha, const Tensor& x) {
+		requireSameShape(x, "axpy");
+
+#pragma omp parallel for if(data.size() >= PARALLEL_THRESHOLD)
+		for (size_t i = 0; i < data.size(); i++) {
+			data[i] += alpha * x.data[i];
+		}
+
+		return *this;
+	}
+
+	// this = beta * this + alpha * x
+	Tensor& axpby(float alpha, const Tensor& x, float beta) {
+		requireSameShape(x, "axpby");
+
+#pragma omp parallel for if(data.size() >= PARALLEL_THRESHOLD)
+		for (size_t i = 0; i < data.size(); i++) {
+			data[i] = beta * data[i] + alpha * x.data[i];
+		}
+
+		return *this;
+	}
+
+	// this += alpha * x * y, element-wise
+	Tensor& addcmul(float alpha, const Tensor& x, const Tensor& y) {
+		requireSameShape(x, "addcmul");
+		requireSameShape(y, "addcmul");
+
+#pragma omp parallel for if(data.size() >= PARALLEL_THRESHOLD)
+		for (size_t i = 0; i < data.size(); i++) {
+			data[i] += alpha * x.data[i] * y.data[i];
+		}
+
+		return *this;
+	}
+
+	// Evaluates data[i] = func(data[i], other[i]) in one pass, func is inlined unlike apply
+	template <typename F>
+	Tensor& zip(const Tensor& other, F func) {
+		requireSameShape(other, "zip");
+
+#pragma omp parallel for if(data.size() >= PARALLEL_THRESHOLD)
+		for (size_t i = 0; i < data.size(); i++) {
+			data[i] = func(data[i], other.data[i]);
+		}
+
+		return *this;
 	}
 
 	const Tensor operator-(const Tensor& other) const {
@@ -153,7 +336,7 @@ public:
 			throw std::invalid_argument("Shape mismatch: Tensors must have the same shape for element-wise subtraction");
 		}
 
-		Tensor result = Tensor(shape);
+		Tensor result = uninitialized(shape, layout);
 
 		for (size_t i = 0; i < data.size(); i++) {
 			result.data[i] = data[i] - other.data[i];
@@ -162,10 +345,51 @@ public:
 		return result;
 	}
 
+	// Matrix product viewing each tensor as a 2D matrix (first dimension x the rest):
+	// result = alpha * op(a) * op(b) + beta * result, followed by the optional bias / activation epilogue
+	static void matmul(const Tensor& a, bool trans_a, const Tensor& b, bool trans_b, Tensor& result,
+					   float alpha = 1.0f, float beta = 0.0f, const Gemm::Epilogue& epilogue = Gemm::Epilogue())
+	{
+		size_t a_rows = a.shape[0], a_cols = a.data.size() / a.shape[0];
+		size_t b_rows = b.shape[0], b_cols = b.data.size() / b.shape[0];
+
+		size_t M = trans_a ? a_cols : a_rows;
+		size_t K = trans_a ? a_rows : a_cols;
+		size_t N = trans_b ? b_rows : b_cols;
+
+		if ((trans_b ? b_cols : b_rows) != K) {
+			throw std::invalid_argument("Shape mismatch: inner dimensions of matrix product do not match");
+		}
+		if (result.shape[0] != M || result.data.size() != M * N) {
+			throw std::invalid_argument("Shape mismatch: result tensor does not match matrix product");
+		}
+
+		Gemm::sgemm(trans_a, trans_b, M, N, K,
+			alpha, a.data.data(), a_cols, b.data.data(), b_cols,
+			beta, result.data.data(), N, epilogue);
+	}
+
+	Tensor matmul(const Tensor& other) const {
+		Tensor result({ shape[0], other.data.size() / other.shape[0] });
+		matmul(*this, false, other, false, result);
+		return result;
+	}
+
 	const std::vector<size_t>& getShape() const {
 		return shape;
 	}
 
+	Layout::TYPES getLayout() const {
+		return layout;
+	}
+
+	// Copy of a 4-d tensor in another layout
+	Tensor reorder(Layout::TYPES to) const {
+		Tensor result = uninitialized(shape, to);
+		Layout::reorder(data.data(), layout, result.data.data(), to, shape);
+		return result;
+	}
+
 	const std::vector<size_t>& getStrides() const {
 		return strides;
 	}
@@ -190,7 +414,7 @@ public:
 	}
 
 	Tensor square() const {
-		Tensor result(shape);
+		Tensor result = uninitialized(shape, layout);
 		for (size_t i = 0; i < data.size(); ++i) {
 			result.data[i] = data[i] * data[i];
 		}
@@ -198,7 +422,7 @@ public:
 	}
 
 	Tensor sqrt() const {
-		Tensor result(shape);
+		Tensor result = uninitialized(shape, layout);
 		for (size_t i = 0; i < data.size(); ++i) {
 			result.data[i] = std::sqrt(data[i]);
 		}
@@ -206,7 +430,7 @@ public:
 	}
 
 	Tensor clamp(float a, float b) const {
-		Tensor result(shape);
+		Tensor result = uninitialized(shape, layout);
 		for (size_t i = 0; i < data.size(); ++i) {
 			result.data[i] = std::max(a, std::min(b, data[i]));
 		}
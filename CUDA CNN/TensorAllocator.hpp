@@ -0,0 +1,177 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdlib>
+#include <mutex>
+#include <new>
+#include <vector>
+
+#ifdef _WIN32
+#include <malloc.h>
+#else
+#include <sys/mman.h>
+#endif
+
+// Pooled, 64 byte aligned memory behind every owning TensorBuffer. Requests are rounded up to a
+// size class, four per power of two so at most a quarter is slack, and freed blocks are cached on
+// a free list per class: tensors created for every batch are recycled instead of going through
+// malloc and faulting in fresh pages each time. Up to the cache limit of free memory is kept,
+// blocks past it go back to the system. Blocks of at least HUGE_PAGE bytes are aligned to 2 MB
+// and, on Linux, advised for transparent huge pages, which cuts the TLB misses of walking large
+// activation and parameter arenas.
+class TensorAllocator {
+public:
+	static const size_t ALIGNMENT = 64;
+	static const size_t HUGE_PAGE = 2 << 20;
+
+	// free memory kept for reuse unless setCacheLimit says otherwise
+	static const size_t DEFAULT_CACHE_LIMIT = size_t(256) << 20;
+
+	// Memory for at least n floats, nullptr for none. capacity receives the floats actually
+	// allocated, which deallocate needs back.
+	static float* allocate(size_t n, size_t& capacity) {
+		capacity = 0;
+		if (!n) return nullptr;
+
+		const size_t size_class = sizeClass(n * sizeof(float));
+		const size_t bytes = classBytes(size_class);
+		Pool& pool = instance();
+		bool huge_pages;
+
+		{
+			std::lock_guard<std::mutex> lock(pool.mutex);
+			huge_pages = pool.huge_pages;
+
+			if (size_class < pool.free.size() && !pool.free[size_class].empty()) {
+				float* block = pool.free[size_class].back();
+				pool.free[size_class].pop_back();
+				pool.cached -= bytes;
+				capacity = bytes / sizeof(float);
+				return block;
+			}
+		}
+
+		float* block = systemAllocate(bytes, huge_pages && bytes >= HUGE_PAGE);
+		capacity = bytes / sizeof(float);
+		return block;
+	}
+
+	static void deallocate(float* block, size_t capacity) {
+		if (!block) return;
+
+		const size_t bytes = capacity * sizeof(float);
+		const size_t size_class = sizeClass(bytes);
+		Pool& pool = instance();
+
+		{
+			std::lock_guard<std::mutex> lock(pool.mutex);
+
+			if (pool.cached + bytes <= pool.limit) {
+				if (size_class >= pool.free.size()) pool.free.resize(size_class + 1);
+				pool.free[size_class].push_back(block);
+				pool.cached += bytes;
+				return;
+			}
+		}
+
+		systemFree(block);
+	}
+
+	// Most free memory the pool keeps, lowering it releases cached blocks right away
+	static void setCacheLimit(size_t bytes) {
+		Pool& pool = instance();
+		std::lock_guard<std::mutex> lock(pool.mutex);
+		pool.limit = bytes;
+		releaseCached(pool, bytes);
+	}
+
+	// Whether new blocks of HUGE_PAGE bytes or more are backed by transparent huge pages, on by default
+	static void setHugePages(bool enabled) {
+		Pool& pool = instance();
+		std::lock_guard<std::mutex> lock(pool.mutex);
+		pool.huge_pages = enabled;
+	}
+
+	// Gives every cached block back to the system
+	static void trim() {
+		Pool& pool = instance();
+		std::lock_guard<std::mutex> lock(pool.mutex);
+		releaseCached(pool, 0);
+	}
+
+	static size_t cachedBytes() {
+		Pool& pool = instance();
+		std::lock_guard<std::mutex> lock(pool.mutex);
+		return pool.cached;
+	}
+
+private:
+	struct Pool {
+		std::mutex mutex;
+		std::vector<std::vector<float*>> free;
+		size_t cached = 0;
+		size_t limit = DEFAULT_CACHE_LIMIT;
+		bool huge_pages = true;
+	};
+
+	// never destroyed, so tensors with static storage can still free their memory at exit
+	static Pool& instance() {
+		static Pool* pool = new Pool();
+		return *pool;
+	}
+
+	// classes 0 to 3 are 64 to 256 bytes, then four per power of two: 2^p + q * 2^(p - 2), q = 1..4
+	static size_t sizeClass(size_t bytes) {
+		if (bytes <= 4 * ALIGNMENT) return (bytes + ALIGNMENT - 1) / ALIGNMENT - 1;
+
+		size_t p = 0;
+		for (size_t v = bytes - 1; v >>= 1;) p++;
+
+		const size_t step = size_t(1) << (p - 2);
+		const size_t q = (bytes - (size_t(1) << p) + step - 1) / step;
+		return 4 + (p - 8) * 4 + (q - 1);
+	}
+
+	static size_t classBytes(size_t size_class) {
+		if (size_class < 4) return (size_class + 1) * ALIGNMENT;
+
+		const size_t p = (size_class - 4) / 4 + 8, q = (size_class - 4) % 4 + 1;
+		return (size_t(1) << p) + q * (size_t(1) << (p - 2));
+	}
+
+	// frees cached blocks, largest first, until at most keep bytes are cached
+	static void releaseCached(Pool& pool, size_t keep) {
+		for (size_t c = pool.free.size(); c-- > 0 && pool.cached > keep;) {
+			while (!pool.free[c].empty() && pool.cached > keep) {
+				systemFree(pool.free[c].back());
+				pool.free[c].pop_back();
+				pool.cached -= classBytes(c);
+			}
+		}
+	}
+
+	static float* systemAllocate(size_t bytes, bool huge_page) {
+		const size_t alignment = huge_page ? HUGE_PAGE : ALIGNMENT;
+		void* memory = nullptr;
+
+#ifdef _WIN32
+		memory = _aligned_malloc(bytes, alignment);
+#else
+		if (posix_memalign(&memory, alignment, bytes)) memory = nullptr;
+#ifdef MADV_HUGEPAGE
+		if (memory && huge_page) madvise(memory, bytes, MADV_HUGEPAGE);
+#endif
+#endif
+
+		if (!memory) throw std::bad_alloc();
+		return static_cast<float*>(memory);
+	}
+
+	static void systemFree(float* block) {
+#ifdef _WIN32
+		_aligned_free(block);
+#else
+		free(block);
+#endif
+	}
+};
\ No newline at end of file
@@ -0,0 +1,146 @@
+#pragma once
+
+#include "TensorAllocator.hpp"
+#include <algorithm>
+
+// Contiguous float storage behind Tensor::data. A buffer either owns its memory, 64 byte aligned
+// and taken from the TensorAllocator pool, or is bound to memory owned elsewhere (a parameter
+// arena, a mapped file, ...). Copies are always owning, and assigning into a bound buffer of the
+// same size writes through to the bound memory.
+class TensorBuffer {
+private:
+	float* ptr = nullptr;
+	size_t count = 0;
+
+	// floats allocated from the pool, 0 while bound or empty
+	size_t capacity = 0;
+	bool bound = false;
+
+public:
+	TensorBuffer() = default;
+
+	TensorBuffer(size_t n, float initial) {
+		allocate(n);
+		std::fill(ptr, ptr + n, initial);
+	}
+
+	// non-owning, memory must outlive the buffer
+	TensorBuffer(float* memory, size_t n) : ptr(memory), count(n), bound(true) {}
+
+	TensorBuffer(const TensorBuffer& other) {
+		allocate(other.count);
+		std::copy(other.begin(), other.end(), ptr);
+	}
+
+	TensorBuffer(TensorBuffer&& other) noexcept { take(other); }
+
+	~TensorBuffer() { release(); }
+
+	// n floats left unset, for storage that is written in full before it is read
+	static TensorBuffer uninitialized(size_t n) {
+		TensorBuffer buffer;
+		buffer.allocate(n);
+		return buffer;
+	}
+
+	TensorBuffer& operator=(const TensorBuffer& other) {
+		if (this == &other) return *this;
+
+		if (!bound || count != other.count) {
+			// owned memory is reused when it is large enough
+			if (bound || capacity < other.count) {
+				release();
+				allocate(other.count);
+			}
+			count = other.count;
+		}
+
+		std::copy(other.begin(), other.end(), ptr);
+		return *this;
+	}
+
+	// binding a buffer always wins, otherwise values are written through to bound memory
+	TensorBuffer& operator=(TensorBuffer&& other) noexcept {
+		if (this == &other) return *this;
+
+		if (bound && !other.bound && count == other.count) {
+			std::copy(other.begin(), other.end(), ptr);
+			return *this;
+		}
+
+		release();
+		take(other);
+		return *this;
+	}
+
+	void resize(size_t n, float initial = 0.0f) {
+		if (bound && n == count) return;
+
+		if (bound || n > capacity) {
+			// a bound buffer detaches into memory of its own, keeping its values
+			const float* old = ptr;
+			const size_t old_count = count, old_capacity = capacity;
+
+			size_t new_capacity;
+			float* memory = TensorAllocator::allocate(n, new_capacity);
+			std::copy(old, old + std::min(n, old_count), memory);
+			if (old_capacity) TensorAllocator::deallocate(const_cast<float*>(old), old_capacity);
+
+			ptr = memory;
+			capacity = new_capacity;
+			bound = false;
+		}
+
+		if (n > count) std::fill(ptr + count, ptr + n, initial);
+		count = n;
+	}
+
+	// points the buffer at external memory of the same size, dropping any owned storage
+	void bind(float* memory) {
+		release();
+		ptr = memory;
+		bound = true;
+	}
+
+	bool isBound() const { return bound; }
+
+	size_t size() const { return count; }
+	bool empty() const { return count == 0; }
+
+	float* data() { return ptr; }
+	const float* data() const { return ptr; }
+
+	float* begin() { return ptr; }
+	float* end() { return ptr + count; }
+	const float* begin() const { return ptr; }
+	const float* end() const { return ptr + count; }
+
+	float& operator[](size_t i) { return ptr[i]; }
+	const float& operator[](size_t i) const { return ptr[i]; }
+
+private:
+	// owned memory for n floats, any previous storage must have been released
+	void allocate(size_t n) {
+		ptr = TensorAllocator::allocate(n, capacity);
+		count = n;
+		bound = false;
+	}
+
+	// returns owned memory to the pool, leaving ptr and count to the caller
+	void release() {
+		if (capacity) TensorAllocator::deallocate(ptr, capacity);
+		capacity = 0;
+	}
+
+	void take(TensorBuffer& other) {
+		ptr = other.ptr;
+		count = other.count;
+		capacity = other.capacity;
+		bound = other.bound;
+
+		other.ptr = nullptr;
+		other.count = 0;
+		other.capacity = 0;
+		other.bound = false;
+	}
+};
\ No newline at end of file
@@ -0,0 +1,129 @@
+#pragma once
+
+#include "Tensor.hpp"
+#include "MappedFile.hpp"
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
+#include <fstream>
+
+// Binary tensor file: a fixed header followed by the raw little-endian data, starting on a
+// 64 byte boundary so it can be used in place once the file is memory mapped.
+//
+//     TensorFileHeader | padding to DATA_ALIGNMENT | data[shape[0] * ... * shape[rank - 1]]
+class TensorFile {
+public:
+	static const uint32_t VERSION = 1;
+	static const uint32_t MAX_RANK = 8;
+	static const uint64_t DATA_ALIGNMENT = 64;
+
+	enum DTYPES : uint32_t {
+		FLOAT32 = 0
+	};
+
+	struct TensorFileHeader {
+		char magic[8];
+		uint32_t version;
+		uint32_t dtype;
+		uint32_t rank;
+		uint32_t reserved;
+		uint64_t data_offset;
+		uint64_t shape[MAX_RANK];
+	};
+
+	static void write(const char* path, const Tensor& tensor) {
+		const std::vector<size_t>& shape = tensor.getShape();
+		if (shape.size() > MAX_RANK) {
+			throw std::invalid_argument("Tensor rank is too large for the tensor file format.");
+		}
+
+		TensorFileHeader header = {};
+		std::memcpy(header.magic, MAGIC, sizeof(header.magic));
+		header.version = VERSION;
+		header.dtype = FLOAT32;
+		header.rank = static_cast<uint32_t>(shape.size());
+		header.data_offset = (sizeof(TensorFileHeader) + DATA_ALIGNMENT - 1) / DATA_ALIGNMENT * DATA_ALIGNMENT;
+		for (size_t i = 0; i < shape.size(); i++) header.shape[i] = shape[i];
+
+		std::ofstream fout(path, std::ios::binary);
+		if (!fout.is_open()) {
+			throw std::runtime_error(std::string("Failed to create ") + path);
+		}
+
+		std::vector<char> padding(header.data_offset - sizeof(TensorFileHeader), 0);
+		fout.write(reinterpret_cast<const char*>(&header), sizeof(header));
+		fout.write(padding.data(), padding.size());
+		fout.write(reinterpret_cast<const char*>(tensor.data.data()), tensor.data.size() * sizeof(float));
+
+		if (!fout) {
+			throw std::runtime_error(std::string("Failed to write ") + path);
+		}
+	}
+
+	static bool exists(const char* path) {
+		return std::ifstream(path, std::ios::binary).good();
+	}
+
+	// Validates the header of a mapped tensor file and returns its shape
+	static std::vector<size_t> readHeader(const MappedFile& file) {
+		if (file.size() < sizeof(TensorFileHeader)) {
+			throw std::runtime_error("File is too small to be a tensor file.");
+		}
+
+		TensorFileHeader header;
+		std::memcpy(&header, file.data(), sizeof(header));
+
+		if (std::memcmp(header.magic, MAGIC, sizeof(header.magic)) || header.version != VERSION) {
+			throw std::runtime_error("Not a tensor file, or unsupported version.");
+		}
+		if (header.dtype != FLOAT32 || header.rank == 0 || header.rank > MAX_RANK || header.data_offset % DATA_ALIGNMENT) {
+			throw std::runtime_error("Unsupported tensor file layout.");
+		}
+
+		if (header.data_offset > file.size()) {
+			throw std::runtime_error("Tensor file is truncated.");
+		}
+
+		// the dims are untrusted, check them against the floats after data_offset by division
+		// rather than multiplying them out, which could wrap around
+		const uint64_t available = (file.size() - header.data_offset) / sizeof(float);
+		uint64_t count = 1;
+
+		for (uint32_t i = 0; i < header.rank; i++) {
+			if (header.shape[i] && count > available / header.shape[i]) {
+				throw std::runtime_error("Tensor file is truncated.");
+			}
+			count *= header.shape[i];
+		}
+
+		return std::vector<size_t>(header.shape, header.shape + header.rank);
+	}
+
+private:
+	static constexpr const char* MAGIC = "CNNTENSR";
+};
+
+// A tensor file mapped into memory, its tensor reads straight from the mapping with no parsing
+// or copy. Pages are loaded on first touch and shared between processes mapping the same file.
+class MappedTensor {
+private:
+	MappedFile file;
+	Tensor tensor;
+
+public:
+	explicit MappedTensor(const char* path) : file(path) {
+		std::vector<size_t> shape = TensorFile::readHeader(file);
+
+		uint64_t offset;
+		std::memcpy(&offset, file.data() + offsetof(TensorFile::TensorFileHeader, data_offset), sizeof(offset));
+
+		tensor = Tensor::bind(shape, reinterpret_cast<float*>(file.data() + offset));
+	}
+
+	MappedTensor(const MappedTensor&) = delete;
+	MappedTensor& operator=(const MappedTensor&) = delete;
+
+	const Tensor& get() const {
+		return tensor;
+	}
+};
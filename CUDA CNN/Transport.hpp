@@ -0,0 +1,31 @@
+#pragma once
+
+#include <cstddef>
+
+// Links from one process of a distributed job to its two neighbours on a ring of size()
+// processes: rank() sends to (rank() + 1) % size() and receives from (rank() + size() - 1) % size().
+// This is all the ring collectives need, and keeps every backend to two connections per process.
+// Calls must be made in the same order on every rank and from one thread at a time.
+class Transport {
+public:
+	virtual ~Transport() {}
+
+	virtual size_t rank() const = 0;
+	virtual size_t size() const = 0;
+
+	// Sends send_bytes to the next rank while receiving recv_bytes from the previous one, returns
+	// once both are complete. Both directions progress together, so a whole ring can call this at
+	// once without deadlocking however large the messages are.
+	virtual void sendRecv(const void* send, size_t send_bytes, void* recv, size_t recv_bytes) = 0;
+
+	void send(const void* data, size_t bytes) {
+		sendRecv(data, bytes, nullptr, 0);
+	}
+
+	void recv(void* data, size_t bytes) {
+		sendRecv(nullptr, 0, data, bytes);
+	}
+
+	size_t next() const { return (rank() + 1) % size(); }
+	size_t previous() const { return (rank() + size() - 1) % size(); }
+};
\ No newline at end of file
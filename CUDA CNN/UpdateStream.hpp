@@ -0,0 +1,150 @@
+#pragma once
+
+#include "Collectives.hpp"
+#include "Optimizer.hpp"
+#include "Parallel.hpp"
+#include <deque>
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+#include <exception>
+
+// Finishes the gradients of a training step on a background thread while backward carries on
+// with earlier layers. Backward submits ranges of the parameter arena as soon as the layers
+// owning them are done; for each range, in submission order, the stream adds the gradients
+// accumulated over earlier micro-batches, sums them over all ranks of the transport and updates
+// the parameters with the optimizer. Ranges must be submitted in the same order on every rank.
+class UpdateStream {
+private:
+	struct Range {
+		size_t begin;
+		size_t end;
+	};
+
+	Transport* transport;
+	std::vector<float> scratch;
+
+	// the step being applied, set by begin
+	Optimizer* optimizer = nullptr;
+	float* parameters = nullptr;
+	float* gradients = nullptr;
+	const float* accumulated = nullptr;
+
+	std::deque<Range> queue;
+	size_t pending = 0;
+	bool stopping = false;
+	std::exception_ptr error;
+
+	std::mutex mutex;
+	std::condition_variable changed;
+	std::thread worker;
+
+public:
+	explicit UpdateStream(Transport* _transport = nullptr) : transport(_transport) {
+		worker = std::thread(&UpdateStream::run, this);
+	}
+
+	~UpdateStream() {
+		{
+			std::lock_guard<std::mutex> lock(mutex);
+			stopping = true;
+		}
+		changed.notify_all();
+		worker.join();
+	}
+
+	UpdateStream(const UpdateStream&) = delete;
+	UpdateStream& operator=(const UpdateStream&) = delete;
+
+	// ring the gradients are summed over, nullptr when training alone
+	Transport* getTransport() { return transport; }
+
+	// Starts a step over an arena of n floats. accumulated, when given, is added to the gradients
+	// before they are reduced; a null optimizer only reduces.
+	void begin(Optimizer* _optimizer, float* _parameters, float* _gradients, const float* _accumulated, size_t n) {
+		wait();
+
+		optimizer = _optimizer;
+		parameters = _parameters;
+		gradients = _gradients;
+		accumulated = _accumulated;
+
+		if (optimizer) optimizer->beginStep(n);
+	}
+
+	// Queues [begin, end) of the arena, its gradients must not be touched until wait returns
+	void submit(size_t begin, size_t end) {
+		{
+			std::lock_guard<std::mutex> lock(mutex);
+			queue.push_back({ begin, end });
+			pending++;
+		}
+		changed.notify_all();
+	}
+
+	// Applies [begin, end) on the calling thread, after every range submitted before it, with the
+	// caller's parallel loops. For ranges nothing is left to overlap with, such as the last bucket
+	// of backward, where the stream's single thread would leave the cores idle.
+	void finish(size_t begin, size_t end) {
+		wait();
+		apply({ begin, end });
+	}
+
+	// Blocks until every submitted range is applied, rethrows a failure of the stream
+	void wait() {
+		std::unique_lock<std::mutex> lock(mutex);
+		changed.wait(lock, [this] { return !pending; });
+
+		if (error) {
+			std::exception_ptr e = error;
+			error = nullptr;
+			std::rethrow_exception(e);
+		}
+	}
+
+private:
+	void run() {
+		// backward keeps the cores busy, the stream's own loops stay on this thread; finish runs
+		// the ranges nothing overlaps with on the caller's threads instead
+		Parallel::setThreads(1);
+
+		std::unique_lock<std::mutex> lock(mutex);
+
+		while (true) {
+			changed.wait(lock, [this] { return stopping || !queue.empty(); });
+			if (stopping) return;
+
+			Range range = queue.front();
+			queue.pop_front();
+			lock.unlock();
+
+			// after a failure the ring is out of step, the remaining ranges are dropped
+			if (!error) {
+				try {
+					apply(range);
+				}
+				catch (...) {
+					error = std::current_exception();
+				}
+			}
+
+			lock.lock();
+			pending--;
+			changed.notify_all();
+		}
+	}
+
+	void apply(const Range& range) {
+		const size_t count = range.end - range.begin;
+
+		if (accumulated) {
+			float* g = gradients + range.begin;
+			const float* a = accumulated + range.begin;
+#pragma omp parallel for if(count >= Tensor::PARALLEL_THRESHOLD && !Parallel::inParallel())
+			for (size_t i = 0; i < count; i++) g[i] += a[i];
+		}
+
+		if (transport) Collectives::allReduce(*transport, gradients + range.begin, count, scratch);
+		if (optimizer) optimizer->stepRange(parameters, gradients, range.begin, range.end);
+	}
+};
\ No newline at end of file
@@ -0,0 +1,229 @@
+#pragma once
+
+#include "Parallel.hpp"
+#include <cmath>
+#include <cstring>
+#include <cstdint>
+#include <algorithm>
+
+#if defined(__AVX512F__) || defined(__AVX2__)
+#include <immintrin.h>
+#endif
+
+// Vectorized exp, sigmoid and row softmax over float arrays. exp is the Cephes range reduction
+// x = n * ln2 + r, |r| <= ln2 / 2, with a degree 6 polynomial for e^r and 2^n built in the
+// exponent bits. Inputs are clamped to [EXP_MIN, EXP_MAX], so results stay finite;
+// inside that range the relative error is below 2e-7 (about 2 ulp). The AVX-512, AVX2 + FMA and scalar
+// paths evaluate the same approximation, they differ at most by the rounding of the fused adds.
+class VectorMath {
+public:
+	static constexpr float EXP_MIN = -87.3365447505531f;
+	static constexpr float EXP_MAX = 88.3762626647949f;
+
+	// elements per parallel task of the element-wise kernels
+	static const size_t BLOCK = 4096;
+
+	static float exp(float x) {
+		x = x < EXP_MIN ? EXP_MIN : x > EXP_MAX ? EXP_MAX : x;
+
+		const float n = std::nearbyint(x * LOG2E);
+		float r = x - n * LN2_HI;
+		r = r - n * LN2_LO;
+
+		// 2^n from the exponent bits, n is in [-126, 127] after the clamp
+		const uint32_t bits = static_cast<uint32_t>(static_cast<int32_t>(n) + 127) << 23;
+		float scale;
+		std::memcpy(&scale, &bits, sizeof(scale));
+
+		return polynomial(r) * scale;
+	}
+
+	static float sigmoid(float x) {
+		return 1.0f / (1.0f + exp(-x));
+	}
+
+	static void exp(const float* in, float* out, size_t n) {
+		map(in, out, n, [](const float* i, float* o, size_t count) { expBlock(i, o, count); });
+	}
+
+	static void sigmoid(const float* in, float* out, size_t n) {
+		map(in, out, n, [](const float* i, float* o, size_t count) { sigmoidBlock(i, o, count); });
+	}
+
+	// Softmax of every row of a rows x cols matrix, out may alias in. Rows run in parallel.
+	static void softmax(const float* in, float* out, size_t rows, size_t cols) {
+#pragma omp parallel for if(rows * cols >= BLOCK && rows > 1 && !Parallel::inParallel())
+		for (size_t r = 0; r < rows; r++) {
+			softmaxRow(in + r * cols, out + r * cols, cols);
+		}
+	}
+
+	// Single row softmax, returns log(sum(exp(x - max))) + max, the log-sum-exp of the row
+	static float softmaxRow(const float* in, float* out, size_t cols) {
+		const float max = maximum(in, cols);
+
+		float sum = 0.0f;
+		shiftedExp(in, out, cols, max, sum);
+
+		const float inverse = 1.0f / sum;
+		for (size_t i = 0; i < cols; i++) out[i] *= inverse;
+
+		return max + std::log(sum);
+	}
+
+	static float maximum(const float* in, size_t n) {
+		float max = -INFINITY;
+		size_t i = 0;
+
+#if defined(__AVX512F__)
+		__m512 m = _mm512_set1_ps(-INFINITY);
+		for (; i + 16 <= n; i += 16) m = _mm512_max_ps(m, _mm512_loadu_ps(in + i));
+		max = _mm512_reduce_max_ps(m);
+#elif defined(__AVX2__) && defined(__FMA__)
+		__m256 m = _mm256_set1_ps(-INFINITY);
+		for (; i + 8 <= n; i += 8) m = _mm256_max_ps(m, _mm256_loadu_ps(in + i));
+		__m128 h = _mm_max_ps(_mm256_castps256_ps128(m), _mm256_extractf128_ps(m, 1));
+		h = _mm_max_ps(h, _mm_movehl_ps(h, h));
+		h = _mm_max_ss(h, _mm_shuffle_ps(h, h, 1));
+		max = _mm_cvtss_f32(h);
+#endif
+
+		for (; i < n; i++) max = std::max(max, in[i]);
+		return max;
+	}
+
+	// out[i] = exp(in[i] - shift), adding the results to sum
+	static void shiftedExp(const float* in, float* out, size_t n, float shift, float& sum) {
+		size_t i = 0;
+
+#if defined(__AVX512F__)
+		__m512 s = _mm512_setzero_ps();
+		const __m512 sh = _mm512_set1_ps(shift);
+		for (; i + 16 <= n; i += 16) {
+			__m512 v = exp16(_mm512_sub_ps(_mm512_loadu_ps(in + i), sh));
+			_mm512_storeu_ps(out + i, v);
+			s = _mm512_add_ps(s, v);
+		}
+		sum += _mm512_reduce_add_ps(s);
+#elif defined(__AVX2__) && defined(__FMA__)
+		__m256 s = _mm256_setzero_ps();
+		const __m256 sh = _mm256_set1_ps(shift);
+		for (; i + 8 <= n; i += 8) {
+			__m256 v = exp8(_mm256_sub_ps(_mm256_loadu_ps(in + i), sh));
+			_mm256_storeu_ps(out + i, v);
+			s = _mm256_add_ps(s, v);
+		}
+		sum += horizontalSum(s);
+#endif
+
+		for (; i < n; i++) {
+			out[i] = exp(in[i] - shift);
+			sum += out[i];
+		}
+	}
+
+private:
+	static constexpr float LOG2E = 1.44269504088896341f;
+	static constexpr float LN2_HI = 0.693359375f;
+	static constexpr float LN2_LO = -2.12194440e-4f;
+
+	// e^r for |r| <= ln2 / 2
+	static float polynomial(float r) {
+		float p = 1.9875691500e-4f;
+		p = p * r + 1.3981999507e-3f;
+		p = p * r + 8.3334519073e-3f;
+		p = p * r + 4.1665795894e-2f;
+		p = p * r + 1.6666665459e-1f;
+		p = p * r + 5.0000001201e-1f;
+		return p * r * r + r + 1.0f;
+	}
+
+	// runs kernel over blocks of n elements, in parallel when n is large
+	template <typename Kernel>
+	static void map(const float* in, float* out, size_t n, Kernel kernel) {
+		const size_t blocks = (n + BLOCK - 1) / BLOCK;
+
+#pragma omp parallel for if(blocks > 1 && !Parallel::inParallel())
+		for (size_t b = 0; b < blocks; b++) {
+			const size_t begin = b * BLOCK;
+			kernel(in + begin, out + begin, std::min(size_t(BLOCK), n - begin));
+		}
+	}
+
+	static void expBlock(const float* in, float* out, size_t n) {
+		size_t i = 0;
+#if defined(__AVX512F__)
+		for (; i + 16 <= n; i += 16) _mm512_storeu_ps(out + i, exp16(_mm512_loadu_ps(in + i)));
+#elif defined(__AVX2__) && defined(__FMA__)
+		for (; i + 8 <= n; i += 8) _mm256_storeu_ps(out + i, exp8(_mm256_loadu_ps(in + i)));
+#endif
+		for (; i < n; i++) out[i] = exp(in[i]);
+	}
+
+	static void sigmoidBlock(const float* in, float* out, size_t n) {
+		size_t i = 0;
+#if defined(__AVX512F__)
+		const __m512 one = _mm512_set1_ps(1.0f);
+		for (; i + 16 <= n; i += 16) {
+			__m512 e = exp16(_mm512_sub_ps(_mm512_setzero_ps(), _mm512_loadu_ps(in + i)));
+			_mm512_storeu_ps(out + i, _mm512_div_ps(one, _mm512_add_ps(one, e)));
+		}
+#elif defined(__AVX2__) && defined(__FMA__)
+		const __m256 one = _mm256_set1_ps(1.0f);
+		for (; i + 8 <= n; i += 8) {
+			__m256 e = exp8(_mm256_sub_ps(_mm256_setzero_ps(), _mm256_loadu_ps(in + i)));
+			_mm256_storeu_ps(out + i, _mm256_div_ps(one, _mm256_add_ps(one, e)));
+		}
+#endif
+		for (; i < n; i++) out[i] = sigmoid(in[i]);
+	}
+
+#if defined(__AVX512F__)
+	static __m512 exp16(__m512 x) {
+		x = _mm512_min_ps(_mm512_max_ps(x, _mm512_set1_ps(EXP_MIN)), _mm512_set1_ps(EXP_MAX));
+
+		const __m512 n = _mm512_roundscale_ps(_mm512_mul_ps(x, _mm512_set1_ps(LOG2E)), _MM_FROUND_TO_NEAREST_INT | _MM_FROUND_NO_EXC);
+		__m512 r = _mm512_fnmadd_ps(n, _mm512_set1_ps(LN2_HI), x);
+		r = _mm512_fnmadd_ps(n, _mm512_set1_ps(LN2_LO), r);
+
+		__m512 p = _mm512_set1_ps(1.9875691500e-4f);
+		p = _mm512_fmadd_ps(p, r, _mm512_set1_ps(1.3981999507e-3f));
+		p = _mm512_fmadd_ps(p, r, _mm512_set1_ps(8.3334519073e-3f));
+		p = _mm512_fmadd_ps(p, r, _mm512_set1_ps(4.1665795894e-2f));
+		p = _mm512_fmadd_ps(p, r, _mm512_set1_ps(1.6666665459e-1f));
+		p = _mm512_fmadd_ps(p, r, _mm512_set1_ps(5.0000001201e-1f));
+		p = _mm512_fmadd_ps(_mm512_mul_ps(p, r), r, _mm512_add_ps(r, _mm512_set1_ps(1.0f)));
+
+		return _mm512_scalef_ps(p, n);
+	}
+#endif
+
+#if defined(__AVX2__) && defined(__FMA__)
+	static __m256 exp8(__m256 x) {
+		x = _mm256_min_ps(_mm256_max_ps(x, _mm256_set1_ps(EXP_MIN)), _mm256_set1_ps(EXP_MAX));
+
+		const __m256 n = _mm256_round_ps(_mm256_mul_ps(x, _mm256_set1_ps(LOG2E)), _MM_FROUND_TO_NEAREST_INT | _MM_FROUND_NO_EXC);
+		__m256 r = _mm256_fnmadd_ps(n, _mm256_set1_ps(LN2_HI), x);
+		r = _mm256_fnmadd_ps(n, _mm256_set1_ps(LN2_LO), r);
+
+		__m256 p = _mm256_set1_ps(1.9875691500e-4f);
+		p = _mm256_fmadd_ps(p, r, _mm256_set1_ps(1.3981999507e-3f));
+		p = _mm256_fmadd_ps(p, r, _mm256_set1_ps(8.3334519073e-3f));
+		p = _mm256_fmadd_ps(p, r, _mm256_set1_ps(4.1665795894e-2f));
+		p = _mm256_fmadd_ps(p, r, _mm256_set1_ps(1.6666665459e-1f));
+		p = _mm256_fmadd_ps(p, r, _mm256_set1_ps(5.0000001201e-1f));
+		p = _mm256_fmadd_ps(_mm256_mul_ps(p, r), r, _mm256_add_ps(r, _mm256_set1_ps(1.0f)));
+
+		// 2^n from the exponent bits, n is in [-126, 127] after the clamp
+		const __m256i e = _mm256_slli_epi32(_mm256_add_epi32(_mm256_cvtps_epi32(n), _mm256_set1_epi32(127)), 23);
+		return _mm256_mul_ps(p, _mm256_castsi256_ps(e));
+	}
+
+	static float horizontalSum(__m256 v) {
+		__m128 s = _mm_add_ps(_mm256_castps256_ps128(v), _mm256_extractf128_ps(v, 1));
+		s = _mm_add_ps(s, _mm_movehl_ps(s, s));
+		s = _mm_add_ss(s, _mm_shuffle_ps(s, s, 1));
+		return _mm_cvtss_f32(s);
+	}
+#endif
+};
\ No newline at end of file
@@ -0,0 +1,253 @@
+#pragma once
+
+#include "Gemm.hpp"
+#include "Im2Col.hpp"
+#include "Parallel.hpp"
+#include <cmath>
+#include <algorithm>
+#include <type_traits>
+
+// Winograd minimal filtering F(m x m, 3 x 3) for stride 1 convolutions (Lavin and Gray, "Fast
+// Algorithms for Convolutional Neural Networks"). The image is cut into overlapping alpha x alpha
+// tiles, alpha = m + 2, each producing an m x m block of outputs:
+//     Y = A^T [ sum_c (G g_fc G^T) . (B^T d_c B) ] A
+// Per position xi of the transformed tile the sum over channels is one GEMM,
+//     M[xi] (F x tiles) = U[xi] (F x C) * V[xi] (C x tiles),
+// so alpha^2 multiplies replace the 9 m^2 of a direct convolution: 2.25x fewer for F(2x2, 3x3)
+// and 4x fewer for F(4x4, 3x3), which is less accurate in float.
+// The input and output transforms run on TILE_BLOCK tiles at a time, one tile per vector lane.
+class Winograd {
+public:
+	static const size_t TILE_BLOCK = 16;
+	static const size_t GEMM_COLUMNS = 256;
+
+	static size_t tileSize(size_t m) {
+		return m + 2;
+	}
+
+	// tiles of a group of images, rounded up to whole tile blocks
+	static size_t tiles(const ConvGeometry& g, size_t m, size_t images = 1) {
+		const size_t count = images * ((g.out_h + m - 1) / m) * ((g.out_w + m - 1) / m);
+		return (count + TILE_BLOCK - 1) / TILE_BLOCK * TILE_BLOCK;
+	}
+
+	// images per convolve call, enough for the tiles of the group to give the GEMMs about
+	// GEMM_COLUMNS columns
+	static size_t groupSize(const ConvGeometry& g, size_t m) {
+		const size_t per_image = ((g.out_h + m - 1) / m) * ((g.out_w + m - 1) / m);
+		return std::max<size_t>(1, GEMM_COLUMNS / per_image);
+	}
+
+	// floats of transformed filters, alpha^2 x filters x channels
+	static size_t filterSize(size_t filters, size_t channels, size_t m) {
+		return tileSize(m) * tileSize(m) * filters * channels;
+	}
+
+	// floats of scratch for a group of images: the transformed input and the transformed output
+	static size_t scratchSize(const ConvGeometry& g, size_t filters, size_t m, size_t images = 1) {
+		return tileSize(m) * tileSize(m) * (g.channels + filters) * tiles(g, m, images);
+	}
+
+	// U = G g G^T for every 3x3 filter g of filter f and channel c, which starts at
+	// w + f * filter_stride + c * channel_stride. rotate flips each filter by 180 degrees.
+	static void transformFilters(const float* w, size_t filters, size_t channels,
+								 size_t filter_stride, size_t channel_stride, bool rotate, size_t m, float* U)
+	{
+		const size_t alpha = tileSize(m);
+		const float* G = filterTransform(m);
+
+#pragma omp parallel for collapse(2) if(!Parallel::inParallel())
+		for (size_t f = 0; f < filters; f++) {
+			for (size_t c = 0; c < channels; c++) {
+				const float* src = w + f * filter_stride + c * channel_stride;
+
+				float g[3][3];
+				for (size_t i = 0; i < 9; i++) g[i / 3][i % 3] = rotate ? src[8 - i] : src[i];
+
+				float t[6][3];
+				for (size_t i = 0; i < alpha; i++) {
+					for (size_t j = 0; j < 3; j++) {
+						t[i][j] = G[i * 3] * g[0][j] + G[i * 3 + 1] * g[1][j] + G[i * 3 + 2] * g[2][j];
+					}
+				}
+
+				for (size_t i = 0; i < alpha; i++) {
+					for (size_t j = 0; j < alpha; j++) {
+						U[((i * alpha + j) * filters + f) * channels + c] = t[i][0] * G[j * 3] + t[i][1] * G[j * 3 + 1] + t[i][2] * G[j * 3 + 2];
+					}
+				}
+			}
+		}
+	}
+
+	// Convolves a group of CHW images, input_stride apart, with filters transformed by
+	// transformFilters into filters x out_h x out_w outputs, output_stride apart. The bias of the
+	// epilogue is per filter. scratch holds scratchSize(g, filters, m, images) floats.
+	static void convolve(const float* input, size_t images, size_t input_stride, const ConvGeometry& g,
+						 size_t filters, size_t m, const float* U, float* out, size_t output_stride, float* scratch,
+						 const Gemm::Epilogue& epilogue = Gemm::Epilogue())
+	{
+		if (m == 4) convolve<4>(input, images, input_stride, g, filters, U, out, output_stride, scratch, epilogue);
+		else convolve<2>(input, images, input_stride, g, filters, U, out, output_stride, scratch, epilogue);
+	}
+
+private:
+	static const size_t L = TILE_BLOCK;
+
+	// G of F(2x2, 3x3) and F(4x4, 3x3), alpha x 3 row-major
+	static const float* filterTransform(size_t m) {
+		static const float f2[] = {
+			1.0f,  0.0f, 0.0f,
+			0.5f,  0.5f, 0.5f,
+			0.5f, -0.5f, 0.5f,
+			0.0f,  0.0f, 1.0f
+		};
+		static const float f4[] = {
+			 1.0f / 4,   0.0f,       0.0f,
+			-1.0f / 6,  -1.0f / 6,  -1.0f / 6,
+			-1.0f / 6,   1.0f / 6,  -1.0f / 6,
+			 1.0f / 24,  1.0f / 12,  1.0f / 6,
+			 1.0f / 24, -1.0f / 12,  1.0f / 6,
+			 0.0f,       0.0f,       1.0f
+		};
+		return m == 4 ? f4 : f2;
+	}
+
+	// 1-d transforms over L lanes: element k of the input is the row of L floats at d + k * ds,
+	// element r of the output the row at o + r * os. B^T d for the input, A^T y for the output.
+	static void inputTransform(std::integral_constant<size_t, 2>, const float* d, size_t ds, float* o, size_t os) {
+		for (size_t l = 0; l < L; l++) {
+			const float d0 = d[l], d1 = d[ds + l], d2 = d[2 * ds + l], d3 = d[3 * ds + l];
+			o[l] = d0 - d2;
+			o[os + l] = d1 + d2;
+			o[2 * os + l] = d2 - d1;
+			o[3 * os + l] = d1 - d3;
+		}
+	}
+
+	static void inputTransform(std::integral_constant<size_t, 4>, const float* d, size_t ds, float* o, size_t os) {
+		for (size_t l = 0; l < L; l++) {
+			const float d0 = d[l], d1 = d[ds + l], d2 = d[2 * ds + l], d3 = d[3 * ds + l], d4 = d[4 * ds + l], d5 = d[5 * ds + l];
+			o[l] = 4.0f * d0 - 5.0f * d2 + d4;
+			o[os + l] = -4.0f * (d1 + d2) + d3 + d4;
+			o[2 * os + l] = 4.0f * (d1 - d2) - d3 + d4;
+			o[3 * os + l] = 2.0f * (d3 - d1) - d2 + d4;
+			o[4 * os + l] = 2.0f * (d1 - d3) - d2 + d4;
+			o[5 * os + l] = 4.0f * d1 - 5.0f * d3 + d5;
+		}
+	}
+
+	static void outputTransform(std::integral_constant<size_t, 2>, const float* y, size_t ys, float* o, size_t os) {
+		for (size_t l = 0; l < L; l++) {
+			const float y0 = y[l], y1 = y[ys + l], y2 = y[2 * ys + l], y3 = y[3 * ys + l];
+			o[l] = y0 + y1 + y2;
+			o[os + l] = y1 - y2 - y3;
+		}
+	}
+
+	static void outputTransform(std::integral_constant<size_t, 4>, const float* y, size_t ys, float* o, size_t os) {
+		for (size_t l = 0; l < L; l++) {
+			const float y0 = y[l], y1 = y[ys + l], y2 = y[2 * ys + l], y3 = y[3 * ys + l], y4 = y[4 * ys + l], y5 = y[5 * ys + l];
+			const float a = y1 + y2, b = y1 - y2, c = y3 + y4, d = y3 - y4;
+			o[l] = y0 + a + c;
+			o[os + l] = b + 2.0f * d;
+			o[2 * os + l] = a + 4.0f * c;
+			o[3 * os + l] = b + 8.0f * d + y5;
+		}
+	}
+
+	template <size_t M>
+	static void convolve(const float* input, size_t images, size_t input_stride, const ConvGeometry& g, size_t filters,
+						 const float* U, float* out, size_t output_stride, float* scratch, const Gemm::Epilogue& e)
+	{
+		const size_t alpha = M + 2;
+		const size_t C = g.channels;
+		const size_t tiles_w = (g.out_w + M - 1) / M;
+		const size_t per_image = ((g.out_h + M - 1) / M) * tiles_w;
+		const size_t count = images * per_image;
+		const size_t P = tiles(g, M, images);
+		const std::integral_constant<size_t, M> m;
+
+		float* V = scratch;                         // alpha^2 x C x P
+		float* Y = scratch + alpha * alpha * C * P; // alpha^2 x filters x P
+
+		// input transform, V[xi][c][p] = (B^T d B)[xi] for the zero padded tile d of tile p,
+		// tiles numbered image by image
+#pragma omp parallel for collapse(2) if(!Parallel::inParallel())
+		for (size_t c = 0; c < C; c++) {
+			for (size_t p0 = 0; p0 < P; p0 += L) {
+				float d[alpha][alpha][L];
+				float t[alpha][alpha][L];
+
+				for (size_t l = 0; l < L; l++) {
+					const size_t tile = (p0 + l) % per_image;
+					const size_t th = tile / tiles_w, tw = tile % tiles_w;
+					const float* plane = input + (p0 + l) / per_image * input_stride + c * g.height * g.width;
+
+					// tiles inside the image are copied without bounds checks
+					if (p0 + l < count && th * M >= g.padding && tw * M >= g.padding &&
+						th * M + alpha <= g.height + g.padding && tw * M + alpha <= g.width + g.padding) {
+						const float* src = plane + (th * M - g.padding) * g.width + tw * M - g.padding;
+						for (size_t i = 0; i < alpha; i++) {
+							for (size_t j = 0; j < alpha; j++) d[i][j][l] = src[i * g.width + j];
+						}
+						continue;
+					}
+
+					for (size_t i = 0; i < alpha; i++) {
+						long long ih = static_cast<long long>(th * M + i) - static_cast<long long>(g.padding);
+						bool row_inside = p0 + l < count && ih >= 0 && ih < static_cast<long long>(g.height);
+
+						for (size_t j = 0; j < alpha; j++) {
+							long long iw = static_cast<long long>(tw * M + j) - static_cast<long long>(g.padding);
+							bool inside = row_inside && iw >= 0 && iw < static_cast<long long>(g.width);
+							d[i][j][l] = inside ? plane[ih * g.width + iw] : 0.0f;
+						}
+					}
+				}
+
+				for (size_t j = 0; j < alpha; j++) inputTransform(m, d[0][j], alpha * L, t[0][j], alpha * L);
+				for (size_t i = 0; i < alpha; i++) inputTransform(m, t[i][0], L, V + (i * alpha * C + c) * P + p0, C * P);
+			}
+		}
+
+		for (size_t xi = 0; xi < alpha * alpha; xi++) {
+			Gemm::sgemm(false, false, filters, count, C,
+				1.0f, U + xi * filters * C, C, V + xi * C * P, P,
+				0.0f, Y + xi * filters * P, P);
+		}
+
+		// output transform A^T Y A, clipped to the output and followed by the epilogue
+#pragma omp parallel for collapse(2) if(!Parallel::inParallel())
+		for (size_t f = 0; f < filters; f++) {
+			for (size_t p0 = 0; p0 < P; p0 += L) {
+				const float bias = e.bias ? e.bias[f] : 0.0f;
+				float t[M][alpha][L];
+				float y[M][M][L];
+
+				for (size_t j = 0; j < alpha; j++) outputTransform(m, Y + (j * filters + f) * P + p0, alpha * filters * P, t[0][j], alpha * L);
+				for (size_t i = 0; i < M; i++) outputTransform(m, t[i][0], L, y[i][0], L);
+
+				for (size_t l = 0; l < L && p0 + l < count; l++) {
+					const size_t tile = (p0 + l) % per_image;
+					const size_t th = tile / tiles_w, tw = tile % tiles_w;
+					const size_t rows = std::min(M, g.out_h - th * M), cols = std::min(M, g.out_w - tw * M);
+					float* plane = out + (p0 + l) / per_image * output_stride + f * g.out_h * g.out_w;
+
+					for (size_t i = 0; i < rows; i++) {
+						float* dst = plane + (th * M + i) * g.out_w + tw * M;
+
+						for (size_t j = 0; j < cols; j++) {
+							float v = y[i][j][l] + bias;
+
+							if (e.activation == Gemm::Epilogue::RELU) v = std::max(0.0f, v);
+							else if (e.activation == Gemm::Epilogue::SIGMOID) v = VectorMath::sigmoid(v);
+
+							dst[j] = v;
+						}
+					}
+				}
+			}
+		}
+	}
+};
\ No newline at end of file
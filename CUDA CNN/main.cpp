@@ -16,61 +16,49 @@ const char* test_file = "mnist_test.csv";
 const size_t BATCH_SIZE = 60;
 const size_t EPOCHS = 10;
 
-// DELETE LATER : Stole from Network class
-void setBatch(Tensor& batch_tensor, const Tensor& data, size_t batch, size_t batch_size) {
-	size_t start_idx = batch * batch_size * data.getStrides()[0];
-	size_t end_idx = (batch + 1) * batch_size * data.getStrides()[0];
-
-	if (end_idx > data.data.size()) {
-		throw std::out_of_range("batch out of range");
+// Binary tensor files, converted from the CSVs on the first run and memory mapped afterwards
+const char* train_data_file = "mnist_train_data.tensor";
+const char* train_labels_file = "mnist_train_labels.tensor";
+const char* test_data_file = "mnist_test_data.tensor";
+const char* test_labels_file = "mnist_test_labels.tensor";
+
+void convertOnce(const char* csv_file, const char* data_file, const char* labels_file) {
+	if (!TensorFile::exists(data_file) || !TensorFile::exists(labels_file)) {
+		MNISTToTensor::convertCSV(csv_file, data_file, labels_file);
 	}
-
-	std::copy(data.data.begin() + start_idx,
-		data.data.begin() + end_idx,
-		batch_tensor.data.begin());
 }
 
 int main() {
-	// data pair contains: { data, labels }
-	std::pair<Tensor, Tensor> data = MNISTToTensor::parseCSV(input_file);
-	std::pair<Tensor, Tensor> test = MNISTToTensor::parseCSV(test_file);
-
-	size_t NUM_BATCHES = data.first.getShape()[0] / BATCH_SIZE;
+	convertOnce(input_file, train_data_file, train_labels_file);
+	convertOnce(test_file, test_data_file, test_labels_file);
 
-	Tensor test_data = Tensor({ BATCH_SIZE * NUM_BATCHES, 1, 28, 28 });
-	Tensor test_labels = Tensor({ BATCH_SIZE * NUM_BATCHES, 10 });
-
-	setBatch(test_data, data.first, 0, BATCH_SIZE * NUM_BATCHES);
-	setBatch(test_labels, data.second, 0, BATCH_SIZE * NUM_BATCHES);
+	MappedTensor train_data(train_data_file);
+	MappedTensor train_labels(train_labels_file);
+	MappedTensor test_data(test_data_file);
+	MappedTensor test_labels(test_labels_file);
 
 	Network network;
 
 	network.add(new ConvLayer(32, 3, 3, 1, 0, ActivationFunctions::TYPES::RELU));
-	network.add(new ActivationLayer(ActivationFunctions::TYPES::RELU));
 	//network.add(new BatchNormLayer());
 	network.add(new ConvLayer(32, 3, 3, 1, 0, ActivationFunctions::TYPES::RELU));
-	network.add(new ActivationLayer(ActivationFunctions::TYPES::RELU));
 	//network.add(new BatchNormLayer());
 	network.add(new PoolLayer(2, 2));
 	//network.add(new DropoutLayer(0.25));
 
 	network.add(new ConvLayer(64, 3, 3, 1, 0, ActivationFunctions::TYPES::RELU));
-	network.add(new ActivationLayer(ActivationFunctions::TYPES::RELU));
 	//network.add(new BatchNormLayer());
 	network.add(new ConvLayer(64, 3, 3, 1, 0, ActivationFunctions::TYPES::RELU));
-	network.add(new ActivationLayer(ActivationFunctions::TYPES::RELU));
 	//network.add(new BatchNormLayer());
 	network.add(new PoolLayer(2, 2));
 	//network.add(new DropoutLayer(0.25));
 
 	network.add(new FlattenLayer());
 	network.add(new DenseLayer(512, ActivationFunctions::TYPES::RELU));
-	network.add(new ActivationLayer(ActivationFunctions::TYPES::RELU));
 	//network.add(new BatchNormLayer());
 	//network.add(new DropoutLayer(0.25));
 
 	network.add(new DenseLayer(1024, ActivationFunctions::TYPES::RELU));
-	network.add(new ActivationLayer(ActivationFunctions::TYPES::RELU));
 	//network.add(new BatchNormLayer());
 	//network.add(new DropoutLayer(0.5));
 
@@ -80,9 +68,14 @@ int main() {
 	network.setInputShape({ 1, 28, 28 }); // CWH no batch size included
 	network.compile(new CrossEntropyLoss(), new Adam());
 
-	network.fit(test_data, test_labels, EPOCHS, BATCH_SIZE, [&network, &test]() {
-		std::cout << "current validation: " << network.one_hot_accuracy(test.first, test.second) << std::endl;
+	network.fit(train_data.get(), train_labels.get(), EPOCHS, BATCH_SIZE, [&network, &test_data, &test_labels]() {
+		Evaluation validation = network.evaluate(test_data.get(), test_labels.get(), 1000);
+		std::cout << "validation loss: " << validation.loss
+				  << ", accuracy: " << validation.accuracy
+				  << ", top-" << validation.top_k << " accuracy: " << validation.top_k_accuracy << std::endl;
 	});
 
+	network.save("mnist_model.bin");
+
 	return 0;
 }
\ No newline at end of file